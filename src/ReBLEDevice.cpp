@@ -1,13 +1,35 @@
 #include "ReBLEDevice.h"
 #include "ReBLEUtils.h"
-#include "ReLED.h"
+
+ReCommandSession *ReClientCallbacks::sessionFor(NimBLEClient *pClient)
+{
+    ReBot *bot = ctx.getBotRegistry().findByAddress(pClient->getPeerAddress());
+
+    return (bot && sessions) ? &sessions[bot->id] : nullptr;
+}
 
 void ReClientCallbacks::onConnect(NimBLEClient *pClient)
 {
     conTimeout = millis();
 
-    // LED_COLOR_UPDATE(LED_COLOR_RED);
-    // LED_STATUS_UPDATE(start(LED_AP_CONNECTED));
+    logger.info(RE_TAG, "Connected to: %s", pClient->getPeerAddress().toString().c_str());
+
+    ReCommandSession *session = sessionFor(pClient);
+
+    if (session)
+    {
+        session->onConnected();
+    }
+}
+
+void ReClientCallbacks::onConnectFail(NimBLEClient *pClient, int reason)
+{
+    ReCommandSession *session = sessionFor(pClient);
+
+    if (session)
+    {
+        session->onConnectFailed(reason);
+    }
 }
 
 void ReClientCallbacks::onDisconnect(NimBLEClient *pClient, int reason)
@@ -17,85 +39,223 @@ void ReClientCallbacks::onDisconnect(NimBLEClient *pClient, int reason)
     logger.info(RE_TAG, "%s Disconnected, reason = %d, timeout = %lld",
                 pClient->getPeerAddress().toString().c_str(), reason, tm);
 
-    LED_COLOR_UPDATE(LED_COLOR_GREEN);
-    LED_STATUS_UPDATE(on());
+    ReBot *bot = ctx.getBotRegistry().findByAddress(pClient->getPeerAddress());
+
+    if (bot && ReBotState::CONNECTED == bot->state)
+    {
+        bot->state = ReBotState::FOUND;
+    }
+
+    ReCommandSession *session = sessionFor(pClient);
+
+    if (session)
+    {
+        session->onDisconnected(reason);
+    }
+
+    if (eventCallback && *eventCallback)
+    {
+        ReBLEEvent event;
+        event.type = ReBLEEventType::DISCONNECTED;
+        (*eventCallback)(event);
+    }
+}
+
+ReBot *ReScanCallbacks::match(uint64_t address, const uint8_t *payload, size_t length, int8_t rssi, bool &hasServiceData)
+{
+    // Check if this is one of our registered Bots, lookup by the packed 48-bit address
+    ReBot *bot = ctx.getBotRegistry().findByAddress(address);
+
+    if (nullptr == bot)
+    {
+        return nullptr;
+    }
+
+    bot->adv.record(rssi, millis());
+
+    // Get mode, state and battery level from the service data in the advertisement packet
+    size_t dataLength = 0;
+    const uint8_t *serviceData = ReBotProtocol::findServiceData(payload, length, dataLength);
+
+    hasServiceData = nullptr != serviceData;
+
+    if (serviceData)
+    {
+        ReBotProtocol::decodeServiceData(serviceData, dataLength, bot->adv);
+    }
+
+    if (ReBotState::UNKNOWN == bot->state)
+    {
+        bot->state = ReBotState::FOUND;
+    }
+
+    return bot;
 }
 
 void ReScanCallbacks::onResult(const NimBLEAdvertisedDevice *advertisedDevice)
 {
-    // This is a device with our MAC address
-    std::string botMacAddr = config.getString("bot_mac");
-    // Convert to lowercase because NimBLE returns mac address in lowercase
-    std::transform(botMacAddr.begin(), botMacAddr.end(), botMacAddr.begin(), ::tolower);
+    uint32_t cycles = ESP.getCycleCount();
+
+    const std::vector<uint8_t> &payload = advertisedDevice->getPayload();
+    bool hasServiceData = false;
+    ReBot *bot = match(advertisedDevice->getAddress(), payload.data(), payload.size(), advertisedDevice->getRSSI(), hasServiceData);
 
-    if (advertisedDevice->getAddress().toString() == botMacAddr)
+    if (bot)
     {
-        logger.info(RE_TAG, "Advertised Device found: %s", advertisedDevice->getAddress().toString().c_str());
+        /** Connections go to the address, the advertised type corrects the one inferred from the configuration */
+        bot->addressType = advertisedDevice->getAddressType();
+    }
 
-        // Get battery level from the service data in the advertisement packet
-        if (advertisedDevice->haveServiceData())
+    cycles = ESP.getCycleCount() - cycles;
+    stats.advertisements++;
+    stats.cycles += cycles;
+    stats.maxCycles = std::max(stats.maxCycles, cycles);
+
+    size_t filter = (size_t)(scheduler ? scheduler->getFilter() : ReScanFilter::HOST);
+    stats.filterAdvertisements[filter]++;
+
+    if (nullptr == bot)
+    {
+        if (sensors)
         {
-            std::string payload = advertisedDevice->getServiceData();
-            uint8_t batteryLevel = 0;
+            size_t dataLength = 0;
+            const uint8_t *serviceData = ReBotProtocol::findServiceData(payload.data(), payload.size(), dataLength);
 
-            if (payload.length() >= 3) // Check if payload has enough data for battery level
+            if (serviceData)
             {
-                batteryLevel = payload[2] & 0x7F; // Assuming battery level is the third byte in the service data
-            }
+                size_t manufacturerLength = 0;
+                const uint8_t *manufacturerData = ReBotProtocol::findManufacturerData(payload.data(), payload.size(), manufacturerLength);
 
-            logger.info(RE_TAG, "Battery level: %d", batteryLevel);
+                ctx.getSensors().ingest(advertisedDevice->getAddress(), serviceData, dataLength, manufacturerData, manufacturerLength,
+                                        advertisedDevice->getRSSI(), millis());
+            }
         }
 
-        /** stop scan before connecting */
-        NimBLEDevice::getScan()->stop();
+        return;
+    }
+
+    stats.matched++;
+    stats.filterMatched[filter]++;
 
-        /** Save the device reference in a global for the client to use*/
-        advDevice = advertisedDevice;
+    if (scheduler)
+    {
+        scheduler->onBotAdvertisement(hasServiceData, millis());
+    }
+}
 
-        ctx.setBleDeviceFound(true);
+#ifdef RE_SCAN_BENCH
+void ReScanCallbacks::runBenchmark(uint32_t count)
+{
+    // Advertisement with flags and a Switchbot service data structure, battery 95%
+    const uint8_t payload[] = { 0x02, 0x01, 0x06, 0x09, 0x16, 0x3d, 0xfd, 0x48, 0x00, 0xdf, 0x00, 0x00, 0x00 };
+    ReBot *bot = ctx.getBotRegistry().get(0);
+    ReBot saved = bot ? *bot : ReBot();
+    uint64_t known = bot ? bot->address : 0;
+    uint64_t address = 0x123456789abcULL;
+    uint32_t matched = 0;
+    bool hasServiceData = false;
+
+    uint32_t cycles = ESP.getCycleCount();
+
+    for (uint32_t i = 0; i < count; i++)
+    {
+        // One in a hundred advertisements comes from our Bot, xorshift for the others
+        address ^= address << 13;
+        address ^= address >> 7;
+        address ^= address << 17;
 
-        LED_COLOR_UPDATE(LED_COLOR_GREEN);
-        LED_STATUS_UPDATE(on());
+        if (match((i % 100) ? address : known, payload, sizeof(payload), -60, hasServiceData))
+        {
+            matched++;
+        }
     }
+
+    cycles = ESP.getCycleCount() - cycles;
+
+    // The synthetic advertisements must not make the Bot look found
+    if (bot)
+    {
+        *bot = saved;
+    }
+
+    logger.info(RE_TAG, "Scan benchmark: %ld advertisements, %ld matched, %ld cycles per advertisement",
+                count, matched, cycles / count);
 }
+#endif
 
 /** Callback to process the results of the completed scan or restart it */
 void ReScanCallbacks::onScanEnd(const NimBLEScanResults &results, int reason)
 {
-    logger.info(RE_TAG, "Scan Ended, reason: %d, device count: %d; Restarting scan\n", reason, results.getCount());
-    int scanTimeMs = config.get<int>("bot_scantime");
-    NimBLEDevice::getScan()->start(scanTimeMs, false, true);
-
-    LED_COLOR_UPDATE(LED_COLOR_GREEN);
-    LED_STATUS_UPDATE(start(LED_BLE_SCANNING));
+    // ReScanScheduler restarts the scan from the BLE worker
+    logger.debug(RE_TAG, "Scan Ended, reason: %d, device count: %d", reason, results.getCount());
 }
 
-void ReBLEDevice::initialize(BleDataCallback callback)
+void ReBLEDevice::initialize(ReBLEEventCallback callback)
 {
-    bleDataCallback = callback;
+    eventCallback = callback;
 
     /** Initialize NimBLE and set the device name */
     NimBLEDevice::init("SwitchBot-Bot-Client");
-    NimBLEDevice::whiteListAdd(NimBLEAddress(config.getString("bot_mac"), 0));
+
     NimBLEDevice::setPower((esp_power_level_t)config.get<int>("bot_txpower"));
 
     logger.debug(RE_TAG, "BLE power Tx level: %ld", config.get<int>("bot_txpower"));
 
+    timeouts.connect = config.get<int>("bot_to_conn");
+    timeouts.subscribe = config.get<int>("bot_to_sub");
+    timeouts.write = config.get<int>("bot_to_write");
+    timeouts.notify = config.get<int>("bot_to_notify");
+
+    retryPolicy.retries = config.get<int>("bot_retries");
+    retryPolicy.backoff = config.get<int>("bot_retry_ms");
+    retryPolicy.tripFailures = config.get<int>("bot_cb_fails");
+    retryPolicy.openTime = config.get<int>("bot_cb_open");
+
+    connectionPool.begin(&clientCallbacks, config.get<int>("bot_idle"), timeouts.connect);
+    gattCache.begin(ctx.getBotRegistry());
+
+    for (ReBot &bot : ctx.getBotRegistry())
+    {
+        sessions[bot.id].begin(&bot, &gattCache, &timeouts);
+        breakers[bot.id].begin(bot.id, &retryPolicy);
+    }
+
+    clientCallbacks.setSessions(sessions);
+    clientCallbacks.setEventCallback(&eventCallback);
+
+#ifdef RE_SCAN_BENCH
+    scanCallbacks.runBenchmark(10000);
+#endif
+
+    /** Receive notifications by attribute handle, see gapEventCB() */
+    ble_gap_event_listener_register(&gapListener, ReBLEDevice::gapEventCB, this);
+
     pScan = NimBLEDevice::getScan();
 
-    /** Set the callbacks to call when scan events occur, no duplicates */
-    pScan->setScanCallbacks(&scanCallbacks, false);
+    /** Set the callbacks to call when scan events occur, duplicates feed the advertisement rate and presence */
+    pScan->setScanCallbacks(&scanCallbacks, true);
+
+    /** Nothing refers to the scan results, do not store them */
+    pScan->setMaxResults(0);
+
+    directConnect = config.get<bool>("bot_direct");
+
+    /** Sensors need the scan responses and must get through the controller filter */
+    bool sensors = config.get<bool>("sensor_en");
+    bool whitelist = config.get<bool>("bot_whitelist");
+
+    if (sensors && whitelist)
+    {
+        logger.warn(RE_TAG, "Sensor ingestion is enabled, the scan whitelist is not used");
+        whitelist = false;
+    }
 
-    /** Set scan interval (how often) and window (how long) in milliseconds */
-    pScan->setInterval(70);
-    pScan->setWindow(40);
+    scanCallbacks.setSensors(sensors);
+    scanScheduler.setActiveOnly(sensors);
 
-    /**
-     * Active scan will gather scan response data from advertisers
-     * but will use more energy from both devices
-     */
-    // Need active scan to get the service data which contains the battery level
-    pScan->setActiveScan(true);
+    /** Scan interval, window, active scanning and the whitelist filter policy are set by the scheduler */
+    scanScheduler.begin(pScan, config.get<int>("bot_scantime"), whitelist);
+    scanCallbacks.setScheduler(&scanScheduler);
 }
 
 void ReBLEDevice::start()
@@ -105,249 +265,372 @@ void ReBLEDevice::start()
     pScan->start(scanTimeMs);
 }
 
-void ReBLEDevice::notifyCB(NimBLERemoteCharacteristic *pRemoteCharacteristic, uint8_t *pData, size_t length, bool isNotify)
+void ReBLEDevice::loop(bool commandWaiting)
 {
-    std::string str = (isNotify == true) ? "Notification" : "Indication";
-    str += " from ";
-    str += pRemoteCharacteristic->getClient()->getPeerAddress().toString();
-    logger.debug(RE_TAG, "%s", str.c_str());
+    uint32_t now = millis();
+    bool busy = false;
+    bool retrying = false;
 
-    str = "* Service = " + pRemoteCharacteristic->getRemoteService()->getUUID().toString();
-    logger.debug(RE_TAG, "%s", str.c_str());
+    // Sessions are advanced by the NimBLE callbacks, here we only enforce the timeouts and deliver the results
+    for (ReBot &bot : ctx.getBotRegistry())
+    {
+        ReCommandSession &session = sessions[bot.id];
 
-    str = "** Characteristic = " + pRemoteCharacteristic->getUUID().toString();
-    logger.debug(RE_TAG, "%s", str.c_str());
+        session.checkTimeout(now);
 
-    resultData = NimBLEUtils::dataToHexString(pData, length);
+        if (session.isFinished())
+        {
+            finishCommand(bot, session);
+        }
 
-    str = "*** Value = " + resultData;
-    logger.info(RE_TAG, "%s", str.c_str());
+        if (session.isIdle())
+        {
+            if (retries[bot.id].pending)
+            {
+                runRetry(bot, now);
+            }
+            else if (breakers[bot.id].probeDue(now))
+            {
+                startProbe(bot, now);
+            }
+        }
+
+        busy |= bot.busy;
+        retrying |= retries[bot.id].pending;
+    }
+
+    // Aggressive scan while a command waits or shortly after a Bot went missing
+    bool commandPending = retrying || commandWaiting || ctx.getCommandQueue().depth() > 0;
 
-    // call the callback from main.cpp to update the state of the plugin
-    if (bleDataCallback)
+    if (scanScheduler.loop(now, ctx.getBotRegistry(), commandPending, busy) && eventCallback)
     {
-        bleDataCallback(resultData);
+        ReBLEEvent event;
+        event.type = ReBLEEventType::SCAN_MODE;
+        event.scanMode = scanScheduler.getMode();
+        eventCallback(event);
     }
+
+    connectionPool.loop();
+    gattCache.flush(ctx.getBotRegistry());
 }
 
-/** Handles the provisioning of clients and connects / interfaces with the server */
-bool ReBLEDevice::connectToSwitchBot()
+int ReBLEDevice::gapEventCB(ble_gap_event *event, void *arg)
 {
-    NimBLEClient *pClient = nullptr;
-
-    /** Check if we have a client we should reuse first **/
-    if (NimBLEDevice::getCreatedClientCount())
+    // Notifications are routed here by handle, no remote characteristic objects are needed once the GATT handles are cached
+    if (BLE_GAP_EVENT_NOTIFY_RX == event->type)
     {
-        /**
-         *  Special case when we already know this device, we send false as the
-         *  second argument in connect() to prevent refreshing the service database.
-         *  This saves considerable time and power.
-         */
-        pClient = NimBLEDevice::getClientByPeerAddress(scanCallbacks.getAdvDevice()->getAddress());
+        ReBLEDevice *device = (ReBLEDevice *)arg;
+        NimBLEClient *pClient = NimBLEDevice::getClientByHandle(event->notify_rx.conn_handle);
+        ReBot *bot = pClient ? device->ctx.getBotRegistry().findByAddress(pClient->getPeerAddress()) : nullptr;
+        ReGattHandles handles;
 
-        if (pClient)
+        if (bot && device->gattCache.get(*bot, handles) && handles.notify == event->notify_rx.attr_handle)
         {
-            if (pClient->isConnected())
-            {
-                logger.info(RE_TAG, "Client exists and is already conected");
-                return true;
-            } 
-            else
-            {
-                if (!pClient->connect(scanCallbacks.getAdvDevice(), false))
-                {
-                    logger.error(RE_TAG, "Reconnect failed");
-                    return false;
-                }
+            uint8_t data[RE_NOTIFY_MAX_LENGTH];
+            uint16_t length = 0;
 
-                logger.info(RE_TAG, "Reconnected client");
+            if (0 == ble_hs_mbuf_to_flat(event->notify_rx.om, data, sizeof(data), &length))
+            {
+                device->sessions[bot->id].onNotify(data, length);
             }
         }
-        else
+    }
+
+    return 0;
+}
+
+void ReBLEDevice::finishCommand(ReBot &bot, ReCommandSession &session)
+{
+    const ReCommand &command = session.getCommand();
+    ReBotResult result;
+    bool done = ReSessionState::DONE == session.getState();
+
+    if (done)
+    {
+        uint32_t cycles = ESP.getCycleCount();
+        ReBotProtocol::decode(command, session.getResult(), session.getResultLength(), result);
+        cycles = ESP.getCycleCount() - cycles;
+
+        logger.debug(RE_TAG, "Notification decoded in %ld cycles", cycles);
+
+        if (result.hasInfo)
         {
-            /**
-             *  We don't already have a client that knows this device,
-             *  check for a client that is disconnected that we can use.
-             */
-            pClient = NimBLEDevice::getDisconnectedClient();
+            bot.adv.battery = result.battery;
+            bot.adv.switchMode = result.switchMode;
         }
-    }
 
-    /** No client to reuse? Create a new one. */
-    if (!pClient)
+        connectionPool.touch(bot);
+    }
+    else
     {
-        if (NimBLEDevice::getCreatedClientCount() >= MYNEWT_VAL(BLE_MAX_CONNECTIONS))
+        result = ReBotResult::failure(session.getError());
+
+        logger.error(RE_TAG, "Bot %d: command %ld failed: %s", bot.id, command.correlationId, session.getError());
+
+        if (!bot.client || !bot.client->isConnected())
         {
-            logger.error(RE_TAG, "Max clients reached - no more connections available");
-            return false;
+            bot.state = ReBotState::ERROR;
         }
+    }
 
-        pClient = NimBLEDevice::createClient();
+    // reset() keeps the timeline for /switchbot/sessions, the command is copied for the callback
+    ReCommand finished = command;
+    session.reset();
+    bot.busy = false;
 
-        logger.info(RE_TAG, "New client created");
+    // Next command of the batch reuses this connection, even after a delay longer than the idle timeout
+    bot.holdUntil = finished.keepConnection ? millis() + RE_CMD_MAX_DELAY_MS + 1000 : 0;
 
-        pClient->setClientCallbacks(&clientCallbacks, false);
-        /**
-         *  Set initial connection parameters:
-         *  These settings are safe for 3 clients to connect reliably, can go faster if you have less
-         *  connections. Timeout should be a multiple of the interval, minimum is 100ms.
-         *  Min interval: 12 * 1.25ms = 15, Max interval: 12 * 1.25ms = 15, 0 latency, 150 * 10ms = 1500ms timeout
-         */
-        pClient->setConnectionParams(12, 12, 0, 150);
+    // The timeline of the finished command is only available after reset()
+    const uint32_t *timeline = session.getTimeline();
+    recordLatency(timeline);
 
-        /** Set how long we are willing to wait for the connection to complete (milliseconds), default is 30000. */
-        pClient->setConnectTimeout(5 * 1000);
+    // Nothing was written to the Bot, connecting again is safe; once written a retry could press twice
+    ReCircuitBreaker &breaker = breakers[bot.id];
+    bool probe = 0 != breaker.getProbeId() && finished.correlationId == breaker.getProbeId();
+    uint32_t now = millis();
 
-        if (!pClient->connect(scanCallbacks.getAdvDevice()))
-        {
-            /** Created a client but failed to connect, don't need to keep it as it has no data */
-            NimBLEDevice::deleteClient(pClient);
+    if (done || timeline[(size_t)ReSessionState::WRITING])
+    {
+        breaker.onSuccess();
+    }
+    else if (!probe && scheduleRetry(finished, now))
+    {
+        return;
+    }
+    else
+    {
+        breaker.onFailure(now);
+    }
 
-            logger.error(RE_TAG, "Failed to connect, deleted client");
-            return false;
-        }
+    if (done)
+    {
+        char text[RE_RESULT_TEXT_LENGTH];
+        ReBotProtocol::toText(result, text, sizeof(text));
+
+        logger.info(RE_TAG, "Bot %d: command %ld done in %ld us, *** Value = %s", bot.id, finished.correlationId,
+                    session.getTimeline()[(size_t)ReSessionState::DONE], text);
     }
 
-    if (!pClient->isConnected())
+    // Probe results are only for the circuit breaker
+    if (!probe)
     {
-        if (!pClient->connect(scanCallbacks.getAdvDevice()))
+        if (done)
         {
-            logger.error(RE_TAG, "Failed to connect");
-            return false;
+            ctx.getMetrics().record(directConnect ? ReLatencyPhase::COMMAND_DIRECT : ReLatencyPhase::COMMAND_GATED, micros() - finished.enqueuedAt);
         }
-    }
 
-    logger.info(RE_TAG, "Connected to: %s RSSI: %d", pClient->getPeerAddress().toString().c_str(), pClient->getRssi());
+        deliver(finished, result);
+    }
+}
 
-    /** Now we can read/write/subscribe the characteristics of the services we are interested in */
-    NimBLERemoteService *pSvc = nullptr;
-    NimBLERemoteCharacteristic *pChr = nullptr;
+void ReBLEDevice::deliver(const ReCommand &command, const ReBotResult &result)
+{
+    ctx.getMetrics().count(result.error ? ReCommandOutcome::FAILED : ReCommandOutcome::DONE);
 
-    pSvc = pClient->getService(serviceUUID);
+    // main.cpp updates the state of the plugin from its own loop
+    if (eventCallback)
+    {
+        ReBLEEvent event;
+        event.type = ReBLEEventType::COMMAND_DONE;
+        event.command = command;
+        event.result = result;
+        eventCallback(event);
+    }
+}
 
-    if (pSvc)
+bool ReBLEDevice::scheduleRetry(const ReCommand &command, uint32_t now)
+{
+    if (command.attempt >= retryPolicy.retries)
     {
-        // Type: notify
-        pChr = pSvc->getCharacteristic(notifyCharacteristicUUID);
+        return false;
+    }
 
-        if (pChr)
-        {
-            if (pChr->canRead())
-            {
-                logger.debug(RE_TAG, "%s Value: %s", pChr->getUUID().toString().c_str(), pChr->readValue().c_str());
-            }
+    uint32_t delay = reRetryBackoff(retryPolicy, command.attempt + 1);
 
-            if (pChr->canNotify())
-            {
-                // if (!pChr->subscribe(true, notifyCB))
-                if (!pChr->subscribe(true, std::bind(&ReBLEDevice::notifyCB, this, std::placeholders::_1, std::placeholders::_2, std::placeholders::_3, std::placeholders::_4)))
-                {
-                    pClient->disconnect();
-                    return false;
-                }
-
-                logger.info(RE_TAG, "Notifications have been set");
-            }
-            else if (pChr->canIndicate())
-            {
-                /** Send false as first argument to subscribe to indications instead of notifications */
-                // if (!pChr->subscribe(false, notifyCB))
-                if (!pChr->subscribe(false, std::bind(&ReBLEDevice::notifyCB, this, std::placeholders::_1, std::placeholders::_2, std::placeholders::_3, std::placeholders::_4)))
-                {
-                    pClient->disconnect();
-                    return false;
-                }
-
-                logger.debug(RE_TAG, "Indications have been set");
-            }
-        }
-    }
-    else
+    // The retry has to start early enough to get a connect timeout before the command deadline
+    if ((int32_t)(now + delay + timeouts.connect - command.deadline) > 0)
     {
-        logger.error(RE_TAG, "SwitchBot Bot service not found");
+        return false;
     }
 
-    logger.info(RE_TAG, "Connected, subscribed to notifications and waiting for a command...");
+    ReRetrySlot &retry = retries[command.botId];
+    retry.command = command;
+    retry.command.attempt++;
+    retry.at = now + delay;
+    retry.pending = true;
 
+    logger.warn(RE_TAG, "Bot %d: command %ld not delivered, retry %d in %ld ms", command.botId, command.correlationId, retry.command.attempt, delay);
     return true;
 }
 
-bool ReBLEDevice::executeSwitchBotCommand(std::string cmd)
+void ReBLEDevice::runRetry(ReBot &bot, uint32_t now)
 {
-    // Establish connection with the client
-    if (!connectToSwitchBot())
+    ReRetrySlot &retry = retries[bot.id];
+
+    if ((int32_t)(now - retry.at) < 0)
     {
-        logger.error(RE_TAG, "executeSwitchBotCommand: Client not created");
-        return false;
+        return;
     }
 
-    NimBLEClient* pClient = NimBLEDevice::getClientByPeerAddress(scanCallbacks.getAdvDevice()->getAddress());
-    
-    if (!pClient)
+    retry.pending = false;
+    ctx.getMetrics().countRetry();
+
+    if (!executeSwitchBotCommand(retry.command))
     {
-        logger.error(RE_TAG, "executeSwitchBotCommand: Client not exists");
-        return false;
+        breakers[bot.id].onFailure(now);
+        deliver(retry.command, ReBotResult::failure("Error with connection to Switchbot"));
     }
-    else
+}
+
+void ReBLEDevice::startProbe(ReBot &bot, uint32_t now)
+{
+    const ReBotCommandSpec &status = reBotCommand(ReBotOpcode::STATUS);
+    ReCommand probe;
+
+    memcpy(probe.data, status.data, status.length);
+    probe.length = status.length;
+    probe.botId = bot.id;
+    probe.origin = ReCommandOrigin::INTERNAL;
+    probe.correlationId = ctx.getCommandQueue().nextCorrelationId();
+    probe.deadline = now + RE_CMD_TIMEOUT_MS;
+    probe.enqueuedAt = micros();
+
+    logger.info(RE_TAG, "Bot %d: probing with the status command %ld", bot.id, probe.correlationId);
+
+    breakers[bot.id].setProbeId(probe.correlationId);
+
+    if (!executeSwitchBotCommand(probe))
+    {
+        breakers[bot.id].onFailure(now);
+    }
+}
+
+void ReBLEDevice::recordLatency(const uint32_t *timeline)
+{
+    // Phases are recorded when both of their ends were visited, a failed command still reports the completed ones
+    auto phase = [&](ReLatencyPhase phase, ReSessionState from, ReSessionState to)
     {
-        if (!pClient->isConnected())
+        if (timeline[(size_t)from] && timeline[(size_t)to])
         {
-            logger.error(RE_TAG, "executeSwitchBotCommand: Client not connected");
-            return false;
+            ctx.getMetrics().record(phase, timeline[(size_t)to] - timeline[(size_t)from]);
         }
+    };
+
+    // Link is up when the session moves on to discovery or, with cached handles, straight to the CCCD write
+    phase(ReLatencyPhase::CONNECT, ReSessionState::CONNECTING, ReSessionState::DISCOVERING);
+    if (!timeline[(size_t)ReSessionState::DISCOVERING])
+    {
+        phase(ReLatencyPhase::CONNECT, ReSessionState::CONNECTING, ReSessionState::SUBSCRIBING);
     }
 
-    NimBLERemoteService *pSvc = nullptr;
-    NimBLERemoteCharacteristic *pChr = nullptr;
+    phase(ReLatencyPhase::DISCOVERY, ReSessionState::DISCOVERING, ReSessionState::SUBSCRIBING);
+    phase(ReLatencyPhase::SUBSCRIBE, ReSessionState::SUBSCRIBING, ReSessionState::SUBSCRIBED);
+    phase(ReLatencyPhase::WRITE, ReSessionState::WRITING, ReSessionState::AWAITING_NOTIFY);
+    phase(ReLatencyPhase::WRITE_TO_NOTIFY, ReSessionState::WRITING, ReSessionState::DONE);
+}
 
-    pSvc = pClient->getService(serviceUUID);
+bool ReBLEDevice::isReady(uint8_t botId) const
+{
+    return botId >= RE_MAX_BOTS || (sessions[botId].isIdle() && !retries[botId].pending);
+}
 
-    if (pSvc)
+ReStartCheck ReBLEDevice::checkStart(const ReCommand &command, uint32_t now)
+{
+    if (!isReady(command.botId))
     {
-        // Type: write, write without response
-        pChr = pSvc->getCharacteristic(controlCharacteristicUUID);
+        return ReStartCheck::WAIT;
+    }
 
-        if (pChr)
-        {
-            if (pChr->canRead())
-            {
-                logger.debug(RE_TAG, "%s Value: %s", pChr->getUUID().toString().c_str(), pChr->readValue().c_str());
-            }
+    ReBot *bot = ctx.getBotRegistry().get(command.botId);
 
-            if (pChr->canWrite())
-            {
-                std::vector<uint8_t> vPress = stringToHexArray(cmd);
-                logger.info(RE_TAG, "Command data: %s", NimBLEUtils::dataToHexString(vPress.data(), vPress.size()).c_str());
-
-                // All command for Bot must start with 0x57 byte
-                if (vPress.at(0) != 0x57)
-                {
-                    logger.error(RE_TAG, "Write failed - command must start with 0x57 byte");
-                    return false;
-                }
-
-                if (pChr->writeValue(vPress, true))
-                {
-                    logger.info(RE_TAG, "Wrote new value to: %s", pChr->getUUID().toString().c_str());
-                }
-                else
-                {
-                    pClient->disconnect();
-                    return false;
-                }
-
-                if (pChr->canRead())
-                {
-                    logger.info(RE_TAG, "The value of: %s is now: %s", pChr->getUUID().toString().c_str(), pChr->readValue().c_str());
-                }
-            }
-        }
+    // Batch delay after the previous command on this Bot
+    if (bot && command.delay && (now - bot->lastUsed) < command.delay)
+    {
+        return ReStartCheck::WAIT;
     }
-    else
+
+    // All clients taken, the least recently used one is being disconnected for this Bot
+    if (bot && !connectionPool.isAvailable(*bot))
     {
-        logger.error(RE_TAG, "Switchbot Bot service not found.");
+        return ReStartCheck::WAIT;
     }
 
-    return true;
+    if (directConnect || !bot)
+    {
+        return ReStartCheck::START;
+    }
+
+    // Scan gated, wait for an advertisement newer than the command, the Bot listens right after advertising
+    uint32_t enqueuedAt = command.deadline - RE_CMD_TIMEOUT_MS;
+
+    if (bot->adv.count && (int32_t)(bot->adv.lastSeen - enqueuedAt) >= 0)
+    {
+        return ReStartCheck::START;
+    }
+
+    // A stale Bot may not advertise for minutes, do not keep its command until the deadline
+    ReGateWait &gate = gateWaits[bot->id];
+
+    if (gate.correlationId != command.correlationId)
+    {
+        gate.correlationId = command.correlationId;
+        gate.since = now;
+    }
+
+    return (now - gate.since) > RE_SCAN_GATE_WAIT_MS ? ReStartCheck::NOT_ADVERTISING : ReStartCheck::WAIT;
 }
 
+bool ReBLEDevice::isReachable(uint8_t botId) const
+{
+    return botId >= RE_MAX_BOTS || breakers[botId].allowCommand();
+}
+
+bool ReBLEDevice::executeSwitchBotCommand(const ReCommand &command)
+{
+    ReBot *bot = ctx.getBotRegistry().get(command.botId);
+
+    if (!bot)
+    {
+        logger.error(RE_TAG, "executeSwitchBotCommand: Bot %d not found", command.botId);
+        return false;
+    }
+
+    char hex[2 * RE_CMD_MAX_LENGTH + 1] = "";
+    hexArrayToString(command.data, command.length, hex, sizeof(hex));
+    logger.info(RE_TAG, "Command %ld data: %s", command.correlationId, hex);
+
+    // All command for Bot must start with 0x57 byte
+    if (0 == command.length || command.data[0] != 0x57)
+    {
+        logger.error(RE_TAG, "Write failed - command must start with 0x57 byte");
+        return false;
+    }
+
+    bool connected = false;
+    NimBLEClient *pClient = connectionPool.prepare(*bot, connected);
+
+    if (!pClient)
+    {
+        logger.error(RE_TAG, "executeSwitchBotCommand: Client not created");
+        bot->state = ReBotState::ERROR;
+        return false;
+    }
+
+    // Busy Bots are skipped by the idle disconnect and the LRU eviction
+    bot->busy = true;
+
+    if (!sessions[bot->id].start(command, pClient, connected))
+    {
+        bot->busy = false;
+        return false;
+    }
+
+    // Retries and probes would count the same wait again
+    if (0 == command.attempt && ReCommandOrigin::INTERNAL != command.origin)
+    {
+        ctx.getMetrics().record(ReLatencyPhase::QUEUE_WAIT, micros() - command.enqueuedAt);
+    }
+
+    return true;
+}
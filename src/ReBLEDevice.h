@@ -1,27 +1,91 @@
 #pragma once
 
 #include <NimBLEDevice.h>
+#include "ReCircuitBreaker.h"
 #include "ReCommon.h"
 #include "ReContext.h"
+#include "ReCommandSession.h"
+#include "ReConnectionPool.h"
+#include "ReGattCache.h"
+#include "ReScanScheduler.h"
 
-static BLEUUID serviceUUID("cba20d00-224d-11e6-9fb8-0002a5d5c51b");
-static BLEUUID controlCharacteristicUUID("cba20002-224d-11e6-9fb8-0002a5d5c51b");
-static BLEUUID notifyCharacteristicUUID("cba20003-224d-11e6-9fb8-0002a5d5c51b");
+#define RE_SCAN_GATE_WAIT_MS 5000   // scan gated: longest wait for a fresh advertisement once nothing else holds the command
 
+enum class ReBLEEventType : uint8_t
+{
+    COMMAND_STARTED = 0,
+    COMMAND_DONE,           // the result carries the error when the command failed
+    COMMAND_EXPIRED,        // dropped from the queue, only the waiting requester is answered
+    SCAN_MODE,
+    DISCONNECTED
+};
+
+// Posted by the BLE worker and the NimBLE host task, handled by the main loop which owns the LED, MQTT, Matter and the HTTP waiters
+struct ReBLEEvent
+{
+    ReBLEEventType type = ReBLEEventType::COMMAND_DONE;
+    ReScanMode scanMode = ReScanMode::AGGRESSIVE;
+    ReCommand command;
+    ReBotResult result;
+};
+
+typedef std::function<void(const ReBLEEvent&)> ReBLEEventCallback;
+
+enum class ReStartCheck : uint8_t
+{
+    WAIT = 0,           // Bot busy, in a batch delay or, scan gated, not advertised since the command was queued
+    START,
+    NOT_ADVERTISING     // scan gated and no advertisement within RE_SCAN_GATE_WAIT_MS, the command fails
+};
+
+/** Connection events are forwarded to the command session of the Bot */
 class ReClientCallbacks : public NimBLEClientCallbacks
 {
+public:
+    void setSessions(ReCommandSession *sessions) { this->sessions = sessions; }
+    void setEventCallback(const ReBLEEventCallback *callback) { eventCallback = callback; }
+
+private:
     void onConnect(NimBLEClient *pClient) override;
+    void onConnectFail(NimBLEClient *pClient, int reason) override;
     void onDisconnect(NimBLEClient *pClient, int reason) override;
 
-private:
+    ReCommandSession *sessionFor(NimBLEClient *pClient);
+
+    ReContext ctx;
+    ReCommandSession *sessions = nullptr;
+    const ReBLEEventCallback *eventCallback = nullptr;
     uint64_t conTimeout = 0;
 };
 
 /** Define a class to handle the callbacks when scan events are received */
+// Cost of the advertisement callback, only written by the NimBLE host task
+struct ReScanStats
+{
+    uint32_t advertisements = 0;
+    uint32_t matched = 0;
+    uint64_t cycles = 0;
+    uint32_t maxCycles = 0;
+
+    // Split by the filter in use when the advertisement was received
+    uint32_t filterAdvertisements[(size_t)ReScanFilter::COUNT] = {};
+    uint32_t filterMatched[(size_t)ReScanFilter::COUNT] = {};
+};
+
 class ReScanCallbacks : public NimBLEScanCallbacks
 {
 public:
-    const NimBLEAdvertisedDevice *getAdvDevice() const { return advDevice; }
+    // Match the raw address against the registry and update the Bot from the advertisement payload
+    ReBot *match(uint64_t address, const uint8_t *payload, size_t length, int8_t rssi, bool &hasServiceData);
+
+    const ReScanStats &getStats() const { return stats; }
+    void setScheduler(ReScanScheduler *scheduler) { this->scheduler = scheduler; }
+    void setSensors(bool enabled) { sensors = enabled; }
+
+#ifdef RE_SCAN_BENCH
+    // Synthetic advertisement flood through match(), logs the cost per advertisement
+    void runBenchmark(uint32_t count);
+#endif
 
 private:
     void onResult(const NimBLEAdvertisedDevice *advertisedDevice) override;
@@ -30,27 +94,74 @@ private:
     void onScanEnd(const NimBLEScanResults &results, int reason) override;
 
     ReContext ctx;
-    const NimBLEAdvertisedDevice *advDevice = nullptr;
+    ReScanStats stats;
+    ReScanScheduler *scheduler = nullptr;
+    bool sensors = false;                               // decode the advertisements of the other Switchbot devices
 };
 
 class ReBLEDevice
 {
 public:
-    typedef std::function<void(std::string&)> BleDataCallback;
-
-    void initialize(BleDataCallback callback);
+    // Called from loop() when a command has finished or the scan mode has changed, and from the NimBLE host task on disconnect
+    void initialize(ReBLEEventCallback callback);
     void start();
-    bool executeSwitchBotCommand(std::string cmd);
+    // commandWaiting: the BLE worker holds commands which have not started yet
+    void loop(bool commandWaiting);
+
+    // Starts the command and returns immediately, false when it could not be started
+    bool executeSwitchBotCommand(const ReCommand &command);
+    bool isReady(uint8_t botId) const;
+    // Ready and, when scan gated, the Bot has advertised since the command was queued
+    ReStartCheck checkStart(const ReCommand &command, uint32_t now);
+
+    // False while the circuit breaker of the Bot is open, its commands should fail fast
+    bool isReachable(uint8_t botId) const;
+
+    const ReCommandSession &getSession(uint8_t botId) const { return sessions[botId]; }
+    const ReScanStats &getScanStats() const { return scanCallbacks.getStats(); }
+    const ReScanScheduler &getScanScheduler() const { return scanScheduler; }
+    const ReCircuitBreaker &getBreaker(uint8_t botId) const { return breakers[botId]; }
 
 private:
-    void notifyCB(NimBLERemoteCharacteristic *pRemoteCharacteristic, uint8_t *pData, size_t length, bool isNotify);
-    bool connectToSwitchBot();
+    static int gapEventCB(ble_gap_event *event, void *arg);
+
+    void finishCommand(ReBot &bot, ReCommandSession &session);
+    void recordLatency(const uint32_t *timeline);
+    bool scheduleRetry(const ReCommand &command, uint32_t now);
+    void runRetry(ReBot &bot, uint32_t now);
+    void startProbe(ReBot &bot, uint32_t now);
+    void deliver(const ReCommand &command, const ReBotResult &result);
 
+    // Failed command waiting for its backoff to pass, the Bot takes no other command meanwhile
+    struct ReRetrySlot
+    {
+        ReCommand command;
+        uint32_t at = 0;
+        bool pending = false;
+    };
+
+    // Scan gated command of the Bot waiting for an advertisement, and since when
+    struct ReGateWait
+    {
+        uint32_t correlationId = 0;
+        uint32_t since = 0;
+    };
+
+    ReContext ctx;
     ReClientCallbacks clientCallbacks;
     ReScanCallbacks scanCallbacks;
-    BleDataCallback bleDataCallback { nullptr };
+    ReConnectionPool connectionPool;
+    ReGattCache gattCache;
+    ReScanScheduler scanScheduler;
+    ReCommandSession sessions[RE_MAX_BOTS];
+    ReSessionTimeouts timeouts;
+    ReRetryPolicy retryPolicy;
+    ReCircuitBreaker breakers[RE_MAX_BOTS];
+    ReRetrySlot retries[RE_MAX_BOTS];
+    ReGateWait gateWaits[RE_MAX_BOTS];
+    ble_gap_event_listener gapListener;
+    ReBLEEventCallback eventCallback { nullptr };
+    bool directConnect = true;                          // connect by address, do not wait for a fresh advertisement
 
     NimBLEScan* pScan = nullptr;
-    std::string resultData;
-    uint8_t batteryLevel = 0;
 };
\ No newline at end of file
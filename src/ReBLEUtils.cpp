@@ -1,42 +1,155 @@
 #include "ReBLEUtils.h"
 
-#include <Arduino.h>
-#include <iomanip>
-#include <cctype>
+#include <cstring>
 
-bool isValidHexChar(char c)
+// Nibble value of every character, 0xFF for the characters which are not hex digits
+struct ReHexTable
 {
-    return std::isxdigit(static_cast<unsigned char>(c));
+    uint8_t nibble[256];
+
+    constexpr ReHexTable() : nibble()
+    {
+        for (int i = 0; i < 256; i++)
+        {
+            nibble[i] = 0xFF;
+        }
+
+        for (int i = 0; i < 10; i++)
+        {
+            nibble['0' + i] = i;
+        }
+
+        for (int i = 0; i < 6; i++)
+        {
+            nibble['a' + i] = 10 + i;
+            nibble['A' + i] = 10 + i;
+        }
+    }
+};
+
+static constexpr ReHexTable hexTable;
+
+// Reflected CRC-32 of every byte value, polynomial 0xEDB88320
+struct ReCrc32Table
+{
+    uint32_t value[256];
+
+    constexpr ReCrc32Table() : value()
+    {
+        for (uint32_t i = 0; i < 256; i++)
+        {
+            uint32_t crc = i;
+
+            for (int bit = 0; bit < 8; bit++)
+            {
+                crc = (crc >> 1) ^ ((crc & 1) ? 0xEDB88320 : 0);
+            }
+
+            value[i] = crc;
+        }
+    }
+};
+
+static constexpr ReCrc32Table crc32Table;
+
+static constexpr uint32_t crc32Text(const char *text, size_t length)
+{
+    uint32_t crc = 0xFFFFFFFF;
+
+    for (size_t i = 0; i < length; i++)
+    {
+        crc = crc32Table.value[(crc ^ (uint8_t)text[i]) & 0xFF] ^ (crc >> 8);
+    }
+
+    return crc ^ 0xFFFFFFFF;
 }
 
-std::vector<uint8_t> stringToHexArray(const std::string &hexString)
+// Standard check value, and the key of the password "123456" as sent in the protected Bot commands
+static_assert(crc32Text("123456789", 9) == 0xCBF43926, "CRC-32 check value");
+static_assert(crc32Text("123456", 6) == 0x0972D361, "CRC-32 of the Switchbot password");
+
+ReHexStatus stringToHexArray(const char *hexString, uint8_t *buffer, size_t bufferSize, size_t &length)
 {
-    std::vector<uint8_t> result;
+    size_t textLength = strlen(hexString);
 
-    // Check even length
-    if (hexString.length() % 2 != 0)
+    if (0 == textLength)
     {
-        Serial.println("ReBLEUtils: Hex string length must be even");
-        return result;
+        return ReHexStatus::EMPTY;
     }
 
-    // Validate all characters
-    for (char c : hexString)
+    if (textLength % 2 != 0)
     {
-        if (!isValidHexChar(c))
-        {
-            Serial.printf("ReBLEUtils: Invalid hex character: %c\n", c);
-            return result;
-        }
+        return ReHexStatus::ODD_LENGTH;
     }
 
-    // Convert to bytes
-    for (size_t i = 0; i < hexString.length(); i += 2)
+    if (textLength / 2 > bufferSize)
+    {
+        return ReHexStatus::TOO_LONG;
+    }
+
+    // No branch per character, invalid digits set the high bits and are checked once at the end
+    uint8_t invalid = 0;
+
+    for (size_t i = 0; i < textLength; i += 2)
+    {
+        uint8_t high = hexTable.nibble[(uint8_t)hexString[i]];
+        uint8_t low = hexTable.nibble[(uint8_t)hexString[i + 1]];
+
+        invalid |= high | low;
+        buffer[i / 2] = (uint8_t)((high << 4) | (low & 0x0F));
+    }
+
+    if (invalid & 0xF0)
+    {
+        return ReHexStatus::INVALID_CHAR;
+    }
+
+    length = textLength / 2;
+
+    return ReHexStatus::OK;
+}
+
+const char *hexStatusName(ReHexStatus status)
+{
+    switch (status)
+    {
+        case ReHexStatus::OK:               return "OK";
+        case ReHexStatus::EMPTY:            return "Empty hex string";
+        case ReHexStatus::ODD_LENGTH:       return "Hex string length must be even";
+        case ReHexStatus::TOO_LONG:         return "Command is too long";
+        case ReHexStatus::INVALID_CHAR:     return "Invalid hex character";
+        default:                            return "Unknown error";
+    }
+}
+
+size_t hexArrayToString(const uint8_t *data, size_t length, char *buffer, size_t bufferSize)
+{
+    static const char digits[] = "0123456789abcdef";
+
+    if (2 * length + 1 > bufferSize)
+    {
+        return 0;
+    }
+
+    for (size_t i = 0; i < length; i++)
+    {
+        buffer[2 * i] = digits[data[i] >> 4];
+        buffer[2 * i + 1] = digits[data[i] & 0x0F];
+    }
+
+    buffer[2 * length] = '\0';
+
+    return 2 * length;
+}
+
+uint32_t crc32(const uint8_t *data, size_t length)
+{
+    uint32_t crc = 0xFFFFFFFF;
+
+    for (size_t i = 0; i < length; i++)
     {
-        std::string byteString = hexString.substr(i, 2);
-        uint8_t byte = static_cast<uint8_t>(std::stoi(byteString, nullptr, 16));
-        result.push_back(byte);
+        crc = crc32Table.value[(crc ^ data[i]) & 0xFF] ^ (crc >> 8);
     }
 
-    return result;
+    return crc ^ 0xFFFFFFFF;
 }
\ No newline at end of file
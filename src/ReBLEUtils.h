@@ -1,6 +1,23 @@
 #pragma once
 
-#include <vector>
-#include <string>
+#include <cstddef>
+#include <cstdint>
 
-std::vector<uint8_t> stringToHexArray(const std::string& hexString);
\ No newline at end of file
+enum class ReHexStatus : uint8_t
+{
+    OK = 0,
+    EMPTY,
+    ODD_LENGTH,
+    TOO_LONG,
+    INVALID_CHAR
+};
+
+// Decode hex text into a caller provided buffer without allocating, length is set on success
+ReHexStatus stringToHexArray(const char* hexString, uint8_t* buffer, size_t bufferSize, size_t& length);
+const char* hexStatusName(ReHexStatus status);
+
+// Encode bytes as lowercase hex text with the terminating null, returns the text length or 0 when the buffer is too small
+size_t hexArrayToString(const uint8_t* data, size_t length, char* buffer, size_t bufferSize);
+
+// CRC-32 (IEEE 802.3, as zlib crc32()), table driven, the table is built at compile time
+uint32_t crc32(const uint8_t* data, size_t length);
\ No newline at end of file
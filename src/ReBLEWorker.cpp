@@ -0,0 +1,201 @@
+#include "ReBLEWorker.h"
+
+bool ReBLEWorker::initialize()
+{
+    mailbox = xQueueCreate(RE_MAILBOX_SIZE, sizeof(ReBLEEvent));
+
+    if (!mailbox)
+    {
+        logger.error(RE_TAG, "BLE worker: mailbox not created");
+        return false;
+    }
+
+    return true;
+}
+
+bool ReBLEWorker::begin(ReBLEDevice *device, int core, uint8_t priority)
+{
+    this->device = device;
+
+    if (!mailbox)
+    {
+        return false;
+    }
+
+    // Single core chips have core 0 only
+    if (core >= portNUM_PROCESSORS)
+    {
+        core = portNUM_PROCESSORS - 1;
+    }
+
+    if (pdPASS != xTaskCreatePinnedToCore(ReBLEWorker::taskEntry, "BLE Worker", RE_WORKER_STACK_SIZE, this, priority, &handle, core))
+    {
+        logger.error(RE_TAG, "BLE worker: task not created");
+        return false;
+    }
+
+    logger.info(RE_TAG, "BLE worker started on core %d, priority %d", core, priority);
+    return true;
+}
+
+bool ReBLEWorker::post(const ReBLEEvent &event)
+{
+    bool isResult = ReBLEEventType::COMMAND_DONE == event.type || ReBLEEventType::COMMAND_EXPIRED == event.type;
+
+    // A lost result leaves its HTTP waiter hanging and its Matter switch ON, state events only update the LED
+    if (!mailbox || (!isResult && uxQueueMessagesWaiting(mailbox) >= RE_MAILBOX_STATE_EVENTS))
+    {
+        mailboxDropped.fetch_add(1, std::memory_order_relaxed);
+        return false;
+    }
+
+    if (isResult)
+    {
+        while (pdPASS != xQueueSend(mailbox, &event, pdMS_TO_TICKS(RE_MAILBOX_WAIT_MS)))
+        {
+            logger.warn(RE_TAG, "BLE worker: mailbox full, main loop stalled, command %ld result waiting", event.command.correlationId);
+        }
+    }
+    else if (pdPASS != xQueueSend(mailbox, &event, 0))
+    {
+        mailboxDropped.fetch_add(1, std::memory_order_relaxed);
+        return false;
+    }
+
+    uint32_t waiting = uxQueueMessagesWaiting(mailbox);
+    uint32_t highWater = mailboxHighWater.load(std::memory_order_relaxed);
+
+    while (waiting > highWater && !mailboxHighWater.compare_exchange_weak(highWater, waiting, std::memory_order_relaxed))
+    {
+    }
+
+    return true;
+}
+
+bool ReBLEWorker::receive(ReBLEEvent &event)
+{
+    return mailbox && pdPASS == xQueueReceive(mailbox, &event, 0);
+}
+
+void ReBLEWorker::taskEntry(void *arg)
+{
+    ((ReBLEWorker *)arg)->run();
+}
+
+void ReBLEWorker::run()
+{
+    uint32_t remainderUs = 0;
+
+    for (;;)
+    {
+        uint32_t start = micros();
+
+        // Advance the running BLE commands, deliver their results and close idle BLE connections
+        device->loop(backlogCount > 0);
+        dispatch();
+
+        remainderUs += micros() - start;
+        busyMs.fetch_add(remainderUs / 1000, std::memory_order_relaxed);
+        remainderUs %= 1000;
+        loops.fetch_add(1, std::memory_order_relaxed);
+
+        vTaskDelay(pdMS_TO_TICKS(RE_WORKER_PERIOD_MS));
+    }
+}
+
+void ReBLEWorker::dispatch()
+{
+    ReCommandQueue &queue = ctx.getCommandQueue();
+
+    while (backlogCount < backlog.size() && queue.pop(backlog[backlogCount]))
+    {
+        backlogCount++;
+    }
+
+    // A Bot with an older command still waiting keeps its commands in order
+    bool blocked[RE_MAX_BOTS + 1] = {};
+    uint32_t now = millis();
+    size_t kept = 0;
+
+    for (size_t i = 0; i < backlogCount; i++)
+    {
+        const ReCommand &command = backlog[i];
+        bool &botBlocked = blocked[command.botId < RE_MAX_BOTS ? command.botId : RE_MAX_BOTS];
+
+        // Command waited for too long, the requester has given up already
+        if ((int32_t)(now - command.deadline) > 0)
+        {
+            expire(command);
+            continue;
+        }
+
+        ReStartCheck check = botBlocked ? ReStartCheck::WAIT : device->checkStart(command, now);
+
+        // Bot still busy with the previous command, in a batch delay or not advertising yet
+        if (ReStartCheck::WAIT == check)
+        {
+            botBlocked = true;
+            backlog[kept++] = command;
+        }
+        else if (ReStartCheck::NOT_ADVERTISING == check)
+        {
+            logger.warn(RE_TAG, "Bot %d not advertising, command %ld failed", command.botId, command.correlationId);
+            postResult(command, "Switchbot not advertising, try again later");
+        }
+        else
+        {
+            start(command);
+        }
+    }
+
+    backlogCount = kept;
+    backlogDepth.store(kept, std::memory_order_relaxed);
+}
+
+void ReBLEWorker::start(const ReCommand &command)
+{
+    // Bot did not answer the last commands, do not make the requester wait for another connect timeout
+    if (!device->isReachable(command.botId))
+    {
+        logger.warn(RE_TAG, "Bot %d is unreachable, command %ld failed fast", command.botId, command.correlationId);
+        postResult(command, "Switchbot unreachable, try again later");
+    }
+    // Found a device we want to connect to, start the command, the result comes with a COMMAND_DONE event
+    else if (device->executeSwitchBotCommand(command))
+    {
+        logger.debug(RE_TAG, "Command %ld started, waiting for the notification", command.correlationId);
+
+        ReBLEEvent event;
+        event.type = ReBLEEventType::COMMAND_STARTED;
+        event.command = command;
+        post(event);
+    }
+    else
+    {
+        logger.error(RE_TAG, "Failed to connect");
+        postResult(command, "Error with connection to Switchbot");
+    }
+}
+
+void ReBLEWorker::expire(const ReCommand &command)
+{
+    logger.warn(RE_TAG, "Command %ld for Bot %d expired in the queue", command.correlationId, command.botId);
+    ctx.getMetrics().count(ReCommandOutcome::EXPIRED);
+
+    ReBLEEvent event;
+    event.type = ReBLEEventType::COMMAND_EXPIRED;
+    event.command = command;
+    event.result = ReBotResult::failure("Command expired in the queue");
+    post(event);
+}
+
+void ReBLEWorker::postResult(const ReCommand &command, const char *error)
+{
+    ctx.getMetrics().count(ReCommandOutcome::FAILED);
+
+    ReBLEEvent event;
+    event.type = ReBLEEventType::COMMAND_DONE;
+    event.command = command;
+    event.result = ReBotResult::failure(error);
+    post(event);
+}
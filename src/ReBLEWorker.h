@@ -0,0 +1,72 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <type_traits>
+#include <freertos/FreeRTOS.h>
+#include <freertos/queue.h>
+#include <freertos/task.h>
+#include "ReBLEDevice.h"
+
+// Events cross the mailbox as raw bytes
+static_assert(std::is_trivially_copyable<ReBLEEvent>::value, "ReBLEEvent must be trivially copyable");
+
+#define RE_WORKER_STACK_SIZE 6144
+#define RE_WORKER_PERIOD_MS 5       // session timeouts and the queue are checked at least this often
+#define RE_MAILBOX_SIZE (RE_CMD_QUEUE_SIZE + RE_MAX_BOTS)    // events waiting for the main loop
+#define RE_MAILBOX_STATE_EVENTS 8   // slots state events may take, the rest is kept for command results
+#define RE_MAILBOX_WAIT_MS 1000     // a result waits this long for a free slot before a warning, then waits again
+#define RE_WORKER_BACKLOG RE_CMD_QUEUE_SIZE // commands taken off the queue, waiting for their Bot
+
+/**
+ * FreeRTOS task which owns all the BLE command work: it consumes the command queue,
+ * starts the command sessions and runs ReBLEDevice::loop(). Commands are moved from the
+ * queue to a backlog in arrival order and each one starts as soon as its own Bot can take
+ * it, a Bot which is busy, in a batch delay or not advertising only holds up its own commands. Results and state changes go
+ * back to the main loop through the mailbox, so the LED, MQTT, Matter and the HTTP waiters
+ * are only touched from the main loop and radio work never waits for them.
+ */
+class ReBLEWorker
+{
+public:
+    // Create the mailbox, before anything can post to it
+    bool initialize();
+    bool begin(ReBLEDevice *device, int core, uint8_t priority);
+
+    // State events never block and are dropped when their share of the mailbox is full. Command results
+    // (COMMAND_DONE, COMMAND_EXPIRED) are never dropped, they block until the main loop makes room,
+    // they are only posted from the BLE worker
+    bool post(const ReBLEEvent &event);
+    // Main loop, false when the mailbox is empty
+    bool receive(ReBLEEvent &event);
+
+    TaskHandle_t getHandle() const { return handle; }
+    uint32_t getBusyTimeMs() const { return busyMs.load(std::memory_order_relaxed); }
+    uint32_t getLoops() const { return loops.load(std::memory_order_relaxed); }
+    uint32_t getMailboxHighWater() const { return mailboxHighWater.load(std::memory_order_relaxed); }
+    uint32_t getMailboxDropped() const { return mailboxDropped.load(std::memory_order_relaxed); }
+    uint32_t getBacklog() const { return backlogDepth.load(std::memory_order_relaxed); }
+
+private:
+    static void taskEntry(void *arg);
+    void run();
+    void dispatch();
+    void start(const ReCommand &command);
+    void expire(const ReCommand &command);
+    void postResult(const ReCommand &command, const char *error);
+
+    ReContext ctx;
+    ReBLEDevice *device = nullptr;
+    TaskHandle_t handle = nullptr;
+    QueueHandle_t mailbox = nullptr;
+
+    // BLE worker only, commands not started yet in arrival order
+    std::array<ReCommand, RE_WORKER_BACKLOG> backlog;
+    size_t backlogCount = 0;
+
+    std::atomic<uint32_t> busyMs { 0 };
+    std::atomic<uint32_t> loops { 0 };
+    std::atomic<uint32_t> mailboxHighWater { 0 };
+    std::atomic<uint32_t> mailboxDropped { 0 };
+    std::atomic<uint32_t> backlogDepth { 0 };
+};
@@ -0,0 +1,261 @@
+#include "ReBotProtocol.h"
+#include "ReBLEUtils.h"
+#include <cstring>
+
+// Offsets in the get basic info response, byte 0 is the status
+#define RE_INFO_BATTERY 1
+#define RE_INFO_FIRMWARE 2
+#define RE_INFO_TIMERS 8
+#define RE_INFO_FLAGS 9
+#define RE_INFO_HOLD_TIME 10
+#define RE_INFO_LENGTH 11
+
+#define RE_AD_TYPE_SERVICE_DATA16 0x16
+#define RE_SERVICE_UUID16_LEGACY 0x0D00     // older firmware
+#define RE_SERVICE_UUID16 0xFD3D
+#define RE_AD_TYPE_MANUFACTURER 0xFF
+#define RE_COMPANY_ID 0x0969                // Woan Technology
+
+#define RE_ADV_FLAG_SWITCH_MODE 0x80
+#define RE_ADV_FLAG_OFF 0x40
+
+#define RE_INFO_FLAG_INVERTED 0x01
+#define RE_INFO_FLAG_SWITCH_MODE 0x10
+
+bool ReBotProtocol::lookup(const char *text, ReBotOpcode &opcode)
+{
+    uint8_t data[RE_CMD_MAX_LENGTH];
+    size_t length = 0;
+    bool isHex = ReHexStatus::OK == stringToHexArray(text, data, sizeof(data), length);
+
+    for (const ReBotCommandSpec &spec : RE_BOT_COMMANDS)
+    {
+        if (0 == strcmp(text, spec.name) || (isHex && 0 == spec.argLength && length == spec.length && 0 == memcmp(data, spec.data, length)))
+        {
+            opcode = spec.opcode;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+// Data of the first AD structure of the type which starts with one of the 16-bit ids, the id excluded
+static const uint8_t *findAdData(const uint8_t *payload, size_t length, uint8_t type, uint16_t id, uint16_t otherId, size_t &dataLength)
+{
+    // AD structures: length, type, data; the length covers the type and the data
+    size_t pos = 0;
+
+    while (pos + 1 < length && 0 != payload[pos])
+    {
+        size_t adLength = payload[pos];
+
+        if (pos + 1 + adLength > length)
+        {
+            break;
+        }
+
+        // Other vendors may put their own data of the same type next to it
+        if (type == payload[pos + 1] && adLength >= 3)
+        {
+            uint16_t value = payload[pos + 2] | (payload[pos + 3] << 8);
+
+            if (id == value || otherId == value)
+            {
+                dataLength = adLength - 3;
+                return payload + pos + 4;
+            }
+        }
+
+        pos += 1 + adLength;
+    }
+
+    dataLength = 0;
+    return nullptr;
+}
+
+const uint8_t *ReBotProtocol::findServiceData(const uint8_t *payload, size_t length, size_t &dataLength)
+{
+    return findAdData(payload, length, RE_AD_TYPE_SERVICE_DATA16, RE_SERVICE_UUID16, RE_SERVICE_UUID16_LEGACY, dataLength);
+}
+
+const uint8_t *ReBotProtocol::findManufacturerData(const uint8_t *payload, size_t length, size_t &dataLength)
+{
+    return findAdData(payload, length, RE_AD_TYPE_MANUFACTURER, RE_COMPANY_ID, RE_COMPANY_ID, dataLength);
+}
+
+void ReBotProtocol::decodeServiceData(const uint8_t *data, size_t length, ReBotAdvertisement &adv)
+{
+    // Device type, mode and state flags, battery
+    if (length < 3)
+    {
+        return;
+    }
+
+    adv.switchMode = data[1] & RE_ADV_FLAG_SWITCH_MODE;
+    adv.isOn = adv.switchMode && !(data[1] & RE_ADV_FLAG_OFF);
+    adv.battery = data[2] & 0x7F;
+}
+
+void ReBotProtocol::advertisementToJson(const ReBot &bot, uint32_t now, JsonObject doc)
+{
+    static const char *presenceNames[] = { "gone", "present", "stale" };
+
+    const ReBotAdvertisement &adv = bot.adv;
+
+    doc["presence"] = presenceNames[(uint8_t)bot.getPresence(now)];
+    doc["rssi"] = adv.getRssi();
+    doc["rssi_last"] = adv.rssi;
+    doc["battery"] = adv.battery;
+    doc["mode"] = adv.switchMode ? "switch" : "press";
+    doc["is_on"] = adv.isOn;
+    doc["adv_per_min"] = adv.getRatePerMinute();
+    doc["last_seen"] = adv.lastSeen;
+    doc["age_ms"] = adv.count ? now - adv.lastSeen : 0;
+}
+
+size_t ReBotProtocol::frame(const ReBot &bot, const ReCommand &command, uint8_t *buffer, size_t bufferSize)
+{
+    if (!bot.hasPassword)
+    {
+        if (command.length > bufferSize)
+        {
+            return 0;
+        }
+
+        memcpy(buffer, command.data, command.length);
+        return command.length;
+    }
+
+    size_t length = command.length + RE_BOT_PASSWORD_KEY_LENGTH;
+
+    if (command.length < 2 || length > bufferSize)
+    {
+        return 0;
+    }
+
+    // 57 0x ... becomes 57 1x <password CRC-32> ..., i.e. press 57 01 with "123456" is 57 11 09 72 d3 61
+    buffer[0] = command.data[0];
+    buffer[1] = 0x10 | (command.data[1] & 0x0F);
+    buffer[2] = bot.passwordCrc >> 24;
+    buffer[3] = bot.passwordCrc >> 16;
+    buffer[4] = bot.passwordCrc >> 8;
+    buffer[5] = bot.passwordCrc;
+    memcpy(buffer + 2 + RE_BOT_PASSWORD_KEY_LENGTH, command.data + 2, command.length - 2);
+
+    return length;
+}
+
+bool ReBotProtocol::decode(const ReCommand &command, const uint8_t *data, size_t length, ReBotResult &result)
+{
+    result = ReBotResult();
+
+    if (0 == length)
+    {
+        result.error = "Empty notification";
+        return false;
+    }
+
+    if (length > RE_NOTIFY_MAX_LENGTH)
+    {
+        length = RE_NOTIFY_MAX_LENGTH;
+    }
+
+    result.status = data[0];
+    result.length = length - 1;
+    memcpy(result.payload, data + 1, result.length);
+
+    // Get basic info: 57 02
+    bool isInfo = command.length >= 2 && 0x57 == command.data[0] && 0x02 == command.data[1];
+
+    if (isInfo && RE_BOT_STATUS_OK == result.status && length >= RE_INFO_LENGTH)
+    {
+        result.hasInfo = true;
+        result.battery = data[RE_INFO_BATTERY];
+        result.firmware = data[RE_INFO_FIRMWARE];
+        result.timerCount = data[RE_INFO_TIMERS];
+        result.switchMode = data[RE_INFO_FLAGS] & RE_INFO_FLAG_SWITCH_MODE;
+        result.inverted = data[RE_INFO_FLAGS] & RE_INFO_FLAG_INVERTED;
+        result.holdTime = data[RE_INFO_HOLD_TIME];
+    }
+
+    return true;
+}
+
+size_t ReBotProtocol::toText(const ReBotResult &result, char *buffer, size_t bufferSize)
+{
+    if (result.error)
+    {
+        return snprintf(buffer, bufferSize, "ER%s", result.error);
+    }
+
+    if (0 == hexArrayToString(&result.status, 1, buffer, bufferSize))
+    {
+        return 0;
+    }
+
+    return 2 + hexArrayToString(result.payload, result.length, buffer + 2, bufferSize - 2);
+}
+
+void ReBotProtocol::toJson(uint8_t botId, const ReBotResult &result, JsonObject doc)
+{
+    doc["bot"] = botId;
+
+    if (result.error)
+    {
+        doc["status"] = "ER";
+        doc["payload"] = result.error;
+        return;
+    }
+
+    char text[RE_RESULT_TEXT_LENGTH];
+    toText(result, text, sizeof(text));
+
+    doc["payload"] = text + 2;
+    text[2] = '\0';
+    doc["status"] = text;
+
+    if (result.hasInfo)
+    {
+        doc["battery"] = result.battery;
+        doc["firmware"] = result.firmware / 10.0f;
+        doc["timers"] = result.timerCount;
+        doc["mode"] = result.switchMode ? "switch" : "press";
+        doc["inverted"] = result.inverted;
+        doc["hold_time"] = result.holdTime;
+    }
+}
+
+size_t ReBotProtocol::toJson(uint8_t botId, const ReBotResult &result, char *buffer, size_t bufferSize)
+{
+    int length;
+
+    // Error messages are our own literals, nothing in them needs escaping
+    if (result.error)
+    {
+        length = snprintf(buffer, bufferSize, "{\"bot\":%u,\"status\":\"ER\",\"payload\":\"%s\"}", botId, result.error);
+        return (length > 0 && (size_t)length < bufferSize) ? length : 0;
+    }
+
+    char text[RE_RESULT_TEXT_LENGTH];
+    toText(result, text, sizeof(text));
+
+    length = snprintf(buffer, bufferSize, "{\"bot\":%u,\"payload\":\"%s\",\"status\":\"%.2s\"", botId, text + 2, text);
+
+    if (length > 0 && (size_t)length < bufferSize && result.hasInfo)
+    {
+        length += snprintf(buffer + length, bufferSize - length,
+                           ",\"battery\":%u,\"firmware\":%u.%u,\"timers\":%u,\"mode\":\"%s\",\"inverted\":%s,\"hold_time\":%u",
+                           result.battery, result.firmware / 10, result.firmware % 10, result.timerCount,
+                           result.switchMode ? "switch" : "press", result.inverted ? "true" : "false", result.holdTime);
+    }
+
+    if (length <= 0 || (size_t)length + 1 >= bufferSize)
+    {
+        return 0;
+    }
+
+    buffer[length++] = '}';
+    buffer[length] = '\0';
+    return length;
+}
@@ -0,0 +1,124 @@
+#pragma once
+
+#include <ArduinoJson.h>
+#include <cstddef>
+#include <cstdint>
+#include "ReBotRegistry.h"
+#include "ReCommandQueue.h"
+
+#define RE_NOTIFY_MAX_LENGTH 32     // longest Switchbot notification we accept
+#define RE_RESULT_TEXT_LENGTH (2 * RE_NOTIFY_MAX_LENGTH + 1)
+#define RE_RESULT_JSON_LENGTH (RE_RESULT_TEXT_LENGTH + 160)
+
+#define RE_BOT_STATUS_OK 0x01
+
+#define RE_BOT_PASSWORD_KEY_LENGTH 4                                        // CRC-32 of the password, big endian
+#define RE_BOT_FRAME_MAX_LENGTH (RE_CMD_MAX_LENGTH + RE_BOT_PASSWORD_KEY_LENGTH)
+
+enum class ReBotOpcode : uint8_t
+{
+    PRESS = 0,
+    ON,
+    OFF,
+    DOWN,
+    UP,
+    STATUS,
+    MODE,
+    COUNT
+};
+
+// Known Bot command, bytes are encoded at compile time
+struct ReBotCommandSpec
+{
+    ReBotOpcode opcode;
+    const char *name;
+    uint8_t length;
+    uint8_t data[4];
+    uint8_t argLength;      // bytes the caller appends, i.e. the mode
+};
+
+static constexpr ReBotCommandSpec RE_BOT_COMMANDS[] = {
+    { ReBotOpcode::PRESS,   "press",    3, { 0x57, 0x01, 0x00 },    0 },
+    { ReBotOpcode::ON,      "on",       3, { 0x57, 0x01, 0x01 },    0 },
+    { ReBotOpcode::OFF,     "off",      3, { 0x57, 0x01, 0x02 },    0 },
+    { ReBotOpcode::DOWN,    "down",     3, { 0x57, 0x01, 0x03 },    0 },
+    { ReBotOpcode::UP,      "up",       3, { 0x57, 0x01, 0x04 },    0 },
+    { ReBotOpcode::STATUS,  "status",   3, { 0x57, 0x02, 0x00 },    0 },
+    { ReBotOpcode::MODE,    "mode",     3, { 0x57, 0x03, 0x64 },    1 },    // 0x00 press, 0x10 switch, | 0x01 inverse direction
+};
+
+static_assert(sizeof(RE_BOT_COMMANDS) / sizeof(RE_BOT_COMMANDS[0]) == (size_t)ReBotOpcode::COUNT, "RE_BOT_COMMANDS must list every ReBotOpcode");
+
+constexpr const ReBotCommandSpec &reBotCommand(ReBotOpcode opcode)
+{
+    return RE_BOT_COMMANDS[(size_t)opcode];
+}
+
+constexpr bool reBotCommandsOrdered(size_t i = 0)
+{
+    return i == (size_t)ReBotOpcode::COUNT || ((size_t)RE_BOT_COMMANDS[i].opcode == i && reBotCommandsOrdered(i + 1));
+}
+
+static_assert(reBotCommandsOrdered(), "RE_BOT_COMMANDS must be ordered by ReBotOpcode");
+
+/**
+ * Result of one Bot command, decoded in place from the notification bytes.
+ * Typed fields are filled for the get basic info (570200) response, see
+ * https://github.com/OpenWonderLabs/SwitchBotAPI-BLE/blob/latest/devicetypes/bot.md
+ */
+struct ReBotResult
+{
+    const char *error = nullptr;    // set when the command failed, there is no notification then
+    uint8_t status = 0;             // first byte of the notification
+    uint8_t length = 0;             // bytes after the status
+    uint8_t payload[RE_NOTIFY_MAX_LENGTH - 1] = {};
+
+    bool hasInfo = false;
+    uint8_t battery = 0;            // percent
+    uint8_t firmware = 0;           // version x 10
+    uint8_t timerCount = 0;
+    bool switchMode = false;        // dual state (switch) mode, press mode otherwise
+    bool inverted = false;          // inverse direction
+    uint8_t holdTime = 0;           // seconds
+
+    bool isOk() const { return !error && RE_BOT_STATUS_OK == status; }
+
+    static ReBotResult failure(const char *message)
+    {
+        ReBotResult result;
+        result.error = message;
+        return result;
+    }
+};
+
+class ReBotProtocol
+{
+public:
+    // Command name ("press") or its exact bytes as hex text ("570100"), false when it is not in RE_BOT_COMMANDS
+    static bool lookup(const char *text, ReBotOpcode &opcode);
+
+    // Switchbot service data (after the 16-bit UUID) in the raw advertisement payload, nullptr when there is none
+    static const uint8_t *findServiceData(const uint8_t *payload, size_t length, size_t &dataLength);
+    // Switchbot manufacturer data (after the company ID), nullptr when there is none
+    static const uint8_t *findManufacturerData(const uint8_t *payload, size_t length, size_t &dataLength);
+
+    // Bot state from the service data: mode, switch state and battery
+    static void decodeServiceData(const uint8_t *data, size_t length, ReBotAdvertisement &adv);
+
+    // Presence and the cached advertisement fields
+    static void advertisementToJson(const ReBot &bot, uint32_t now, JsonObject doc);
+
+    // Bytes written to the Bot, the command as it is or in the password protected form, 0 when it does not fit
+    static size_t frame(const ReBot &bot, const ReCommand &command, uint8_t *buffer, size_t bufferSize);
+
+    // Parse the notification received as the answer to the command, false when it is empty
+    static bool decode(const ReCommand &command, const uint8_t *data, size_t length, ReBotResult &result);
+
+    // Status and payload as hex text ("01ff00"), or "ER" followed by the error message
+    static size_t toText(const ReBotResult &result, char *buffer, size_t bufferSize);
+
+    // Typed fields, "status" and "payload" keep the format of toText()
+    static void toJson(uint8_t botId, const ReBotResult &result, JsonObject doc);
+    // Same document written straight into the buffer, no JsonDocument; 0 when it does not fit
+    static size_t toJson(uint8_t botId, const ReBotResult &result, char *buffer, size_t bufferSize);
+};
@@ -0,0 +1,275 @@
+#include "ReBotRegistry.h"
+#include "ReBLEUtils.h"
+
+#define RE_ADDRESS_MASK 0x0000FFFFFFFFFFFFULL
+
+static int8_t hexValue(char c)
+{
+    if (c >= '0' && c <= '9') return c - '0';
+    if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+    return -1;
+}
+
+ReBotRegistry::ReBotRegistry()
+{
+    clear();
+}
+
+void ReBotRegistry::clear()
+{
+    bots.fill(ReBot());
+    slots.fill(0);
+    count = 0;
+    generation++;
+}
+
+size_t ReBotRegistry::load(const std::string &macList)
+{
+    clear();
+
+    size_t start = 0;
+    size_t first = 0;
+    size_t last = 0;
+
+    while (nextEntry(macList, start, first, last))
+    {
+        uint64_t address = 0;
+
+        if (parseAddress(macList.c_str() + first, last - first, address))
+        {
+            add(address, inferAddressType(address));
+        }
+    }
+
+    return count;
+}
+
+void ReBotRegistry::loadPasswords(const std::string &passwordList)
+{
+    size_t start = 0;
+    size_t first = 0;
+    size_t last = 0;
+    uint8_t id = 0;
+
+    while (id < count && nextEntry(passwordList, start, first, last))
+    {
+        ReBot &bot = bots[id++];
+
+        bot.hasPassword = last > first;
+        bot.passwordCrc = bot.hasPassword ? crc32((const uint8_t *)passwordList.c_str() + first, last - first) : 0;
+    }
+}
+
+bool ReBotRegistry::nextEntry(const std::string &list, size_t &start, size_t &first, size_t &last)
+{
+    if (start >= list.length())
+    {
+        return false;
+    }
+
+    size_t end = list.find(',', start);
+
+    if (end == std::string::npos)
+    {
+        end = list.length();
+    }
+
+    // Trim spaces around the entry
+    first = start;
+    last = end;
+
+    while (first < last && list[first] == ' ') first++;
+    while (last > first && list[last - 1] == ' ') last--;
+
+    start = end + 1;
+    return true;
+}
+
+ReBot *ReBotRegistry::add(uint64_t address, uint8_t addressType)
+{
+    address &= RE_ADDRESS_MASK;
+
+    if (ReBot *bot = findByAddress(address))
+    {
+        return bot;
+    }
+
+    if (count >= RE_MAX_BOTS)
+    {
+        return nullptr;
+    }
+
+    ReBot &bot = bots[count];
+    bot = ReBot();
+    bot.id = count;
+    bot.address = address;
+    bot.addressType = addressType;
+
+    // Linear probing, the table is never more than half full
+    uint32_t slot = slotOf(address);
+
+    while (slots[slot] != 0)
+    {
+        slot = (slot + 1) & (RE_BOT_SLOTS - 1);
+    }
+
+    slots[slot] = address | ((uint64_t)(count + 1) << 56);
+    count++;
+    generation++;
+
+    return &bot;
+}
+
+ReBot *ReBotRegistry::get(uint8_t id)
+{
+    return (id < count) ? &bots[id] : nullptr;
+}
+
+ReBot *ReBotRegistry::findByAddress(uint64_t address)
+{
+    address &= RE_ADDRESS_MASK;
+    uint32_t slot = slotOf(address);
+
+    for (uint32_t i = 0; i < RE_BOT_SLOTS; i++)
+    {
+        uint64_t entry = slots[slot];
+
+        if (entry == 0)
+        {
+            return nullptr;
+        }
+
+        if ((entry & RE_ADDRESS_MASK) == address)
+        {
+            return &bots[(entry >> 56) - 1];
+        }
+
+        slot = (slot + 1) & (RE_BOT_SLOTS - 1);
+    }
+
+    return nullptr;
+}
+
+void ReBotAdvertisement::record(int8_t rssi, uint32_t now)
+{
+    this->rssi = rssi;
+
+    if (0 == count)
+    {
+        rssiAvg = rssi * 16;
+    }
+    else
+    {
+        rssiAvg += (rssi * 16 - rssiAvg) >> RE_ADV_EWMA_SHIFT;
+
+        int32_t elapsed = now - lastSeen;
+        interval = (count > 1) ? interval + ((elapsed - (int32_t)interval) >> RE_ADV_EWMA_SHIFT) : elapsed;
+    }
+
+    lastSeen = now;
+    count++;
+}
+
+ReBotPresence ReBot::getPresence(uint32_t now) const
+{
+    // Open connection proves the Bot is in range even when it does not advertise
+    if (ReBotState::CONNECTED == state)
+    {
+        return ReBotPresence::PRESENT;
+    }
+
+    if (0 == adv.count)
+    {
+        return ReBotPresence::GONE;
+    }
+
+    uint32_t age = now - adv.lastSeen;
+
+    if (age < RE_PRESENCE_STALE_MS)
+    {
+        return ReBotPresence::PRESENT;
+    }
+
+    return (age < RE_PRESENCE_GONE_MS) ? ReBotPresence::STALE : ReBotPresence::GONE;
+}
+
+bool ReBotRegistry::allFound() const
+{
+    for (size_t i = 0; i < count; i++)
+    {
+        if (!bots[i].isFound())
+        {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+bool ReBotRegistry::allPresent(uint32_t now) const
+{
+    for (size_t i = 0; i < count; i++)
+    {
+        if (ReBotPresence::PRESENT != bots[i].getPresence(now))
+        {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+bool ReBotRegistry::parseAddress(const char *str, size_t length, uint64_t &address)
+{
+    // Exactly "xx:xx:xx:xx:xx:xx"
+    if (length != 17)
+    {
+        return false;
+    }
+
+    uint64_t result = 0;
+
+    for (size_t i = 0; i < 6; i++)
+    {
+        const char *p = str + i * 3;
+        int8_t hi = hexValue(p[0]);
+        int8_t lo = hexValue(p[1]);
+
+        if (hi < 0 || lo < 0 || (i < 5 && p[2] != ':'))
+        {
+            return false;
+        }
+
+        result = (result << 8) | (uint8_t)((hi << 4) | lo);
+    }
+
+    address = result;
+    return true;
+}
+
+void ReBotRegistry::formatAddress(uint64_t address, char *buffer)
+{
+    static const char digits[] = "0123456789abcdef";
+
+    for (int i = 0; i < 6; i++)
+    {
+        uint8_t byte = (address >> ((5 - i) * 8)) & 0xFF;
+        buffer[i * 3] = digits[byte >> 4];
+        buffer[i * 3 + 1] = digits[byte & 0x0F];
+        buffer[i * 3 + 2] = (i < 5) ? ':' : '\0';
+    }
+}
+
+uint32_t ReBotRegistry::slotOf(uint64_t address)
+{
+    // Fold the 48-bit address and mix it with a multiplicative hash, vendor prefix bytes are mostly equal
+    uint32_t folded = (uint32_t)address ^ (uint32_t)(address >> 24);
+    return (folded * 2654435761u) >> (32 - RE_BOT_SLOT_BITS);
+}
+
+uint8_t ReBotRegistry::inferAddressType(uint64_t address)
+{
+    // BLE_ADDR_RANDOM for random static, BLE_ADDR_PUBLIC otherwise
+    return (3 == ((address >> 46) & 0x03)) ? 1 : 0;
+}
@@ -0,0 +1,123 @@
+#pragma once
+
+#include <array>
+#include <string>
+#include <cstdint>
+
+#define RE_MAX_BOTS 8           // maximum number of Bots handled by one gateway
+#define RE_BOT_SLOT_BITS 4      // address hash has 2^bits slots, at least 2 x RE_MAX_BOTS
+#define RE_BOT_SLOTS (1 << RE_BOT_SLOT_BITS)
+#define RE_BOT_INVALID_ID 0xFF
+
+#define RE_PRESENCE_STALE_MS 60000     // no advertisement for this long, the Bot may be out of range
+#define RE_PRESENCE_GONE_MS 300000     // no advertisement for this long, commands are refused
+#define RE_ADV_EWMA_SHIFT 3            // smoothing factor 1/8 for RSSI and advertisement interval
+
+class NimBLEClient;
+
+enum class ReBotState : uint8_t
+{
+    UNKNOWN = 0,        // configured, but not seen by the scanner yet
+    FOUND,              // advertisement received, ready to connect
+    CONNECTED,          // BLE client connected
+    ERROR               // last command failed
+};
+
+enum class ReBotPresence : uint8_t
+{
+    GONE = 0,           // not seen for RE_PRESENCE_GONE_MS or never
+    PRESENT,
+    STALE               // not seen for RE_PRESENCE_STALE_MS
+};
+
+// Cached advertisement data, status queries are answered from here without radio time
+struct ReBotAdvertisement
+{
+    uint32_t lastSeen = 0;                              // millis() of the last advertisement
+    uint32_t count = 0;
+    uint32_t interval = 0;                              // smoothed time between advertisements in ms
+    int16_t rssiAvg = 0;                                // smoothed RSSI x 16
+    int8_t rssi = 0;                                    // RSSI of the last advertisement
+    uint8_t battery = 0;
+    bool switchMode = false;                            // service data, dual state mode
+    bool isOn = false;                                  // service data, switch state in dual state mode
+
+    void record(int8_t rssi, uint32_t now);
+
+    int8_t getRssi() const { return rssiAvg / 16; }
+    uint32_t getRatePerMinute() const { return interval ? 60000 / interval : 0; }
+};
+
+// Single registered Bot, the scan callback finds it through the address hash of ReBotRegistry
+struct ReBot
+{
+    uint64_t address = 0;                               // packed 48-bit MAC address, as NimBLEAddress::operator uint64_t()
+    uint8_t id = RE_BOT_INVALID_ID;
+    uint8_t addressType = 0;
+    ReBotState state = ReBotState::UNKNOWN;
+    ReBotAdvertisement adv;
+    NimBLEClient *client = nullptr;
+    bool busy = false;                                  // command in progress
+    bool hasPassword = false;
+    uint32_t passwordCrc = 0;                           // CRC-32 of the password, computed once when loaded
+
+    // Connection pool
+    uint32_t lastUsed = 0;                              // millis() of the last command or notification
+    uint32_t holdUntil = 0;                             // millis() until the idle disconnect waits for the next batch command
+    uint16_t connects = 0;                              // full connection setups
+    uint16_t reuses = 0;                                // commands sent over an already open connection
+    uint16_t evictions = 0;                             // connections closed to make room for another Bot
+
+    bool isFound() const { return state != ReBotState::UNKNOWN; }
+    bool isHeld(uint32_t now) const { return holdUntil && (int32_t)(holdUntil - now) > 0; }
+    ReBotPresence getPresence(uint32_t now) const;
+};
+
+/**
+ * Fixed capacity table of the Bots owned by this gateway.
+ * Bot ID is the position of the MAC address in the "bot_mac" configuration list.
+ * Lookup by address goes through an open addressing hash of packed 48-bit addresses,
+ * so the cost of the scan callback does not depend on the number of registered Bots.
+ */
+class ReBotRegistry
+{
+public:
+    ReBotRegistry();
+
+    // Load comma separated list of MAC addresses, returns number of registered Bots
+    size_t load(const std::string &macList);
+    // Load comma separated list of passwords in the order of the MAC addresses, empty entry for no password
+    void loadPasswords(const std::string &passwordList);
+    void clear();
+
+    ReBot *add(uint64_t address, uint8_t addressType = 0);
+    ReBot *get(uint8_t id);
+    ReBot *findByAddress(uint64_t address);
+
+    size_t size() const { return count; }
+    // Bumped on every change, users rebuild what they derive from the registry (i.e. the scan whitelist)
+    uint32_t getGeneration() const { return generation; }
+    bool allFound() const;
+    bool allPresent(uint32_t now) const;
+
+    ReBot *begin() { return bots.data(); }
+    ReBot *end() { return bots.data() + count; }
+
+    // Parse "aa:bb:cc:dd:ee:ff" into the NimBLE packed form (least significant byte is the last one)
+    static bool parseAddress(const char *str, size_t length, uint64_t &address);
+    // Format packed address back to lowercase "aa:bb:cc:dd:ee:ff", buffer must hold 18 bytes
+    static void formatAddress(uint64_t address, char *buffer);
+    // Random static addresses have both top bits set, the type is needed before the first advertisement
+    static uint8_t inferAddressType(uint64_t address);
+
+private:
+    static uint32_t slotOf(uint64_t address);
+    // Next trimmed entry of a comma separated list, false at the end
+    static bool nextEntry(const std::string &list, size_t &start, size_t &first, size_t &last);
+
+    std::array<ReBot, RE_MAX_BOTS> bots;
+    // Each slot keeps the 48-bit address and (ID + 1) in the top byte, 0 marks an empty slot
+    std::array<uint64_t, RE_BOT_SLOTS> slots;
+    size_t count = 0;
+    uint32_t generation = 0;
+};
@@ -0,0 +1,90 @@
+#include "ReCircuitBreaker.h"
+#include "ReCommon.h"
+#include <algorithm>
+
+void ReCircuitBreaker::begin(uint8_t botId, const ReRetryPolicy *policy)
+{
+    this->botId = botId;
+    this->policy = policy;
+}
+
+bool ReCircuitBreaker::probeDue(uint32_t now)
+{
+    if (ReBreakerState::OPEN != state || (now - openedAt) < policy->openTime)
+    {
+        return false;
+    }
+
+    state = ReBreakerState::HALF_OPEN;
+    return true;
+}
+
+void ReCircuitBreaker::onSuccess()
+{
+    if (ReBreakerState::CLOSED != state)
+    {
+        logger.info(RE_TAG, "Bot %d: circuit breaker closed, Bot is reachable again", botId);
+    }
+
+    state = ReBreakerState::CLOSED;
+    failures = 0;
+    probeId = 0;
+}
+
+void ReCircuitBreaker::onFailure(uint32_t now)
+{
+    probeId = 0;
+
+    // Failed probe, wait for another cool down
+    if (ReBreakerState::HALF_OPEN == state)
+    {
+        state = ReBreakerState::OPEN;
+        openedAt = now;
+
+        logger.debug(RE_TAG, "Bot %d: probe failed, circuit breaker stays open", botId);
+        return;
+    }
+
+    if (failures < UINT8_MAX)
+    {
+        failures++;
+    }
+
+    if (ReBreakerState::CLOSED == state && failures >= policy->tripFailures)
+    {
+        state = ReBreakerState::OPEN;
+        openedAt = now;
+        trips++;
+
+        logger.warn(RE_TAG, "Bot %d: circuit breaker open after %d unreachable commands, probing in %ld ms", botId, failures, policy->openTime);
+    }
+}
+
+uint32_t ReCircuitBreaker::getOpenTimeLeft(uint32_t now) const
+{
+    if (ReBreakerState::OPEN != state || (now - openedAt) >= policy->openTime)
+    {
+        return 0;
+    }
+
+    return policy->openTime - (now - openedAt);
+}
+
+const char *ReCircuitBreaker::stateName(ReBreakerState state)
+{
+    switch (state)
+    {
+        case ReBreakerState::CLOSED:    return "closed";
+        case ReBreakerState::OPEN:      return "open";
+        case ReBreakerState::HALF_OPEN: return "half_open";
+        default:                        return "unknown";
+    }
+}
+
+uint32_t reRetryBackoff(const ReRetryPolicy &policy, uint8_t attempt)
+{
+    uint32_t delay = policy.backoff << std::min<uint8_t>(attempt - 1, 8);
+
+    // Full delay at most, half of it at least, so retries of several Bots do not run in lockstep
+    return delay / 2 + esp_random() % (delay / 2 + 1);
+}
@@ -0,0 +1,64 @@
+#pragma once
+
+#include <cstdint>
+
+enum class ReBreakerState : uint8_t
+{
+    CLOSED = 0,         // commands run normally
+    OPEN,               // Bot is unreachable, commands fail fast until the cool down is over
+    HALF_OPEN,          // background probe is running, its result closes or reopens the breaker
+    COUNT
+};
+
+// Connect retries inside the command deadline and the circuit breaker thresholds
+struct ReRetryPolicy
+{
+    uint8_t retries = 2;            // connect attempts after the first one
+    uint32_t backoff = 250;         // ms before the first retry, doubled for every next one, jittered
+    uint8_t tripFailures = 3;       // consecutive unreachable commands which open the breaker
+    uint32_t openTime = 30000;      // ms the breaker stays open before it is probed
+};
+
+/**
+ * Per Bot circuit breaker. Only commands which never reached the Bot (failed before the
+ * command write) count as failures, a missing response still proves the Bot is in range.
+ * Updated from the BLE worker task only. The web server reads it from the AsyncTCP task for the
+ * status JSON, single aligned fields written by one task, a reader only ever sees a stale value.
+ */
+class ReCircuitBreaker
+{
+public:
+    void begin(uint8_t botId, const ReRetryPolicy *policy);
+
+    bool allowCommand() const { return ReBreakerState::OPEN != state; }
+
+    // OPEN and the cool down is over, moves to HALF_OPEN and the caller starts the probe
+    bool probeDue(uint32_t now);
+
+    void onSuccess();
+    void onFailure(uint32_t now);
+
+    ReBreakerState getState() const { return state; }
+    uint32_t getTrips() const { return trips; }
+    uint8_t getFailures() const { return failures; }
+    uint32_t getProbeId() const { return probeId; }
+    void setProbeId(uint32_t correlationId) { probeId = correlationId; }
+
+    // Time left until the next probe, 0 when not open
+    uint32_t getOpenTimeLeft(uint32_t now) const;
+
+    static const char *stateName(ReBreakerState state);
+
+private:
+    const ReRetryPolicy *policy = nullptr;
+    uint8_t botId = 0;
+
+    ReBreakerState state = ReBreakerState::CLOSED;
+    uint8_t failures = 0;
+    uint32_t trips = 0;
+    uint32_t openedAt = 0;
+    uint32_t probeId = 0;
+};
+
+// Jittered exponential backoff before the given retry, 1 is the first retry
+uint32_t reRetryBackoff(const ReRetryPolicy &policy, uint8_t attempt);
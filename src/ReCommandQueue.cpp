@@ -0,0 +1,115 @@
+#include "ReCommandQueue.h"
+#include <Arduino.h>
+#include <cstring>
+
+static_assert((RE_CMD_QUEUE_SIZE & (RE_CMD_QUEUE_SIZE - 1)) == 0, "RE_CMD_QUEUE_SIZE must be a power of 2");
+
+ReCommandQueue::ReCommandQueue()
+{
+    for (uint32_t i = 0; i < RE_CMD_QUEUE_SIZE; i++)
+    {
+        cells[i].sequence.store(i, std::memory_order_relaxed);
+    }
+}
+
+ReEnqueueResult ReCommandQueue::enqueue(uint8_t botId, ReCommandOrigin origin, const uint8_t *data, size_t length, uint32_t &correlationId,
+                                        uint16_t delay, bool keepConnection)
+{
+    if (0 == length || length > RE_CMD_MAX_LENGTH || delay > RE_CMD_MAX_DELAY_MS)
+    {
+        return ReEnqueueResult::INVALID;
+    }
+
+    ReCommand command;
+    memcpy(command.data, data, length);
+    command.length = length;
+    command.botId = botId;
+    command.origin = origin;
+    command.delay = delay;
+    command.keepConnection = keepConnection;
+    command.deadline = millis() + RE_CMD_TIMEOUT_MS;
+    command.enqueuedAt = micros();
+    command.correlationId = nextCorrelationId();
+
+    if (!push(command))
+    {
+        return ReEnqueueResult::FULL;
+    }
+
+    correlationId = command.correlationId;
+    return ReEnqueueResult::OK;
+}
+
+bool ReCommandQueue::push(const ReCommand &command)
+{
+    uint32_t pos = enqueuePos.load(std::memory_order_relaxed);
+    Cell *cell = nullptr;
+
+    for (;;)
+    {
+        cell = &cells[pos & (RE_CMD_QUEUE_SIZE - 1)];
+        uint32_t seq = cell->sequence.load(std::memory_order_acquire);
+        int32_t diff = (int32_t)(seq - pos);
+
+        if (0 == diff)
+        {
+            // Cell is free, claim it
+            if (enqueuePos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+            {
+                break;
+            }
+        }
+        else if (diff < 0)
+        {
+            // Consumer has not released this cell yet, the queue is full
+            dropped.fetch_add(1, std::memory_order_relaxed);
+            return false;
+        }
+        else
+        {
+            // Another producer took the cell, retry with the current position
+            pos = enqueuePos.load(std::memory_order_relaxed);
+        }
+    }
+
+    cell->command = command;
+    cell->sequence.store(pos + 1, std::memory_order_release);
+
+    enqueued.fetch_add(1, std::memory_order_relaxed);
+
+    uint32_t current = depth();
+    uint32_t peak = highWater.load(std::memory_order_relaxed);
+
+    while (current > peak && !highWater.compare_exchange_weak(peak, current, std::memory_order_relaxed))
+    {
+    }
+
+    return true;
+}
+
+bool ReCommandQueue::pop(ReCommand &command)
+{
+    uint32_t pos = dequeuePos.load(std::memory_order_relaxed);
+    Cell *cell = &cells[pos & (RE_CMD_QUEUE_SIZE - 1)];
+    uint32_t seq = cell->sequence.load(std::memory_order_acquire);
+
+    // Only one consumer, the cell is either published or the queue is empty
+    if ((int32_t)(seq - (pos + 1)) < 0)
+    {
+        return false;
+    }
+
+    command = cell->command;
+    cell->sequence.store(pos + RE_CMD_QUEUE_SIZE, std::memory_order_release);
+    dequeuePos.store(pos + 1, std::memory_order_relaxed);
+
+    return true;
+}
+
+size_t ReCommandQueue::depth() const
+{
+    uint32_t tail = dequeuePos.load(std::memory_order_relaxed);
+    uint32_t head = enqueuePos.load(std::memory_order_relaxed);
+
+    return (size_t)(head - tail);
+}
@@ -0,0 +1,84 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+#define RE_CMD_QUEUE_SIZE 16        // power of 2
+#define RE_CMD_MAX_LENGTH 24        // longest Bot command in bytes
+#define RE_CMD_TIMEOUT_MS 15000     // command is dropped when not executed within this time
+#define RE_CMD_MAX_DELAY_MS 5000    // longest delay after the previous command of a batch
+
+enum class ReCommandOrigin : uint8_t
+{
+    HTTP = 0,
+    MQTT,
+    MATTER,
+    INTERNAL
+};
+
+// Fixed size command record, copied into the queue so producers never share buffers with the consumer
+struct ReCommand
+{
+    uint32_t correlationId = 0;
+    uint32_t deadline = 0;          // millis() after which the command is dropped
+    uint32_t enqueuedAt = 0;        // micros() when enqueued, for the latency metrics
+    uint8_t botId = 0;
+    ReCommandOrigin origin = ReCommandOrigin::INTERNAL;
+    uint8_t length = 0;
+    uint8_t attempt = 0;            // connect retries done so far
+    uint16_t delay = 0;             // ms to wait after the previous command on this Bot, batch only
+    bool keepConnection = false;    // another batch command for this Bot follows, do not drop the connection
+    uint8_t data[RE_CMD_MAX_LENGTH] = {};
+};
+
+enum class ReEnqueueResult : uint8_t
+{
+    OK = 0,
+    FULL,
+    INVALID
+};
+
+/**
+ * Bounded multi-producer / single-consumer ring of ReCommand records.
+ * Producers are the AsyncTCP task, the MQTT task and the Matter task, the consumer is the BLE worker task.
+ * Every cell carries a sequence number (D. Vyukov bounded queue), so push() is lock-free
+ * and never allocates memory.
+ */
+class ReCommandQueue
+{
+public:
+    ReCommandQueue();
+
+    // Copy the command bytes into a record and push it, correlationId is set on success
+    ReEnqueueResult enqueue(uint8_t botId, ReCommandOrigin origin, const uint8_t *data, size_t length, uint32_t &correlationId,
+                            uint16_t delay = 0, bool keepConnection = false);
+
+    bool push(const ReCommand &command);
+    bool pop(ReCommand &command);
+
+    uint32_t nextCorrelationId() { return correlationCounter.fetch_add(1, std::memory_order_relaxed); }
+
+    size_t depth() const;
+    size_t capacity() const { return RE_CMD_QUEUE_SIZE; }
+    uint32_t getHighWater() const { return highWater.load(std::memory_order_relaxed); }
+    uint32_t getEnqueued() const { return enqueued.load(std::memory_order_relaxed); }
+    uint32_t getDropped() const { return dropped.load(std::memory_order_relaxed); }
+
+private:
+    struct Cell
+    {
+        std::atomic<uint32_t> sequence;
+        ReCommand command;
+    };
+
+    std::array<Cell, RE_CMD_QUEUE_SIZE> cells;
+    std::atomic<uint32_t> enqueuePos { 0 };
+    std::atomic<uint32_t> dequeuePos { 0 };
+    std::atomic<uint32_t> correlationCounter { 1 };
+
+    std::atomic<uint32_t> highWater { 0 };
+    std::atomic<uint32_t> enqueued { 0 };
+    std::atomic<uint32_t> dropped { 0 };
+};
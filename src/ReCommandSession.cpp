@@ -0,0 +1,460 @@
+#include "ReCommandSession.h"
+#include "ReCommon.h"
+
+static const NimBLEUUID cccdUUID((uint16_t)0x2902);
+
+void ReCommandSession::begin(ReBot *bot, ReGattCache *cache, const ReSessionTimeouts *timeouts)
+{
+    this->bot = bot;
+    this->gattCache = cache;
+    this->timeouts = timeouts;
+}
+
+bool ReCommandSession::start(const ReCommand &command, NimBLEClient *client, bool connected)
+{
+    if (!isIdle())
+    {
+        return false;
+    }
+
+    frameLength = ReBotProtocol::frame(*bot, command, frame, sizeof(frame));
+
+    if (0 == frameLength)
+    {
+        logger.error(RE_TAG, "Bot %d: command %ld does not fit the protected frame", bot->id, command.correlationId);
+        return false;
+    }
+
+    this->command = command;
+    this->client = client;
+    resultLength = 0;
+    error.store(nullptr, std::memory_order_relaxed);
+    memset(timeline, 0, sizeof(timeline));
+    startMicros = micros();
+
+    transition(ReSessionState::IDLE, ReSessionState::SCAN_HIT);
+
+    /** Hot connection from the pool is already subscribed to notifications */
+    if (connected)
+    {
+        if (gattCache->get(*bot, handles))
+        {
+            transition(ReSessionState::SCAN_HIT, ReSessionState::SUBSCRIBED);
+            write();
+        }
+        else if (transition(ReSessionState::SCAN_HIT, ReSessionState::DISCOVERING))
+        {
+            discover();
+        }
+
+        return true;
+    }
+
+    transition(ReSessionState::SCAN_HIT, ReSessionState::CONNECTING);
+
+    /** Asynchronous connect to the stored address, completion is reported by onConnected() or onConnectFailed() */
+    if (!client->connect(NimBLEAddress(bot->address, bot->addressType), false, true))
+    {
+        fail("connect not started");
+    }
+
+    return true;
+}
+
+void ReCommandSession::checkTimeout(uint32_t now)
+{
+    ReSessionState current = getState();
+    uint32_t limit = 0;
+
+    switch (current)
+    {
+        case ReSessionState::SCAN_HIT:
+        case ReSessionState::CONNECTING:
+            limit = timeouts->connect;
+            break;
+        case ReSessionState::DISCOVERING:
+        case ReSessionState::SUBSCRIBING:
+        case ReSessionState::SUBSCRIBED:
+            limit = timeouts->subscribe;
+            break;
+        case ReSessionState::WRITING:
+            limit = timeouts->write;
+            break;
+        case ReSessionState::AWAITING_NOTIFY:
+            limit = timeouts->notify;
+            break;
+        default:
+            return;
+    }
+
+    if ((now - stateSince) <= limit)
+    {
+        return;
+    }
+
+    // A late notification may have finished the command meanwhile, its connection is kept then
+    if (!fail("timeout"))
+    {
+        return;
+    }
+
+    logger.warn(RE_TAG, "Bot %d: command %ld timed out in state %s", bot->id, command.correlationId, stateName(current));
+
+    if (ReSessionState::CONNECTING == current)
+    {
+        client->cancelConnect();
+    }
+    else if (client->isConnected())
+    {
+        // Terminates the pending GATT procedure, its late completion can not reach the next command
+        client->disconnect();
+    }
+}
+
+void ReCommandSession::reset()
+{
+    memcpy(lastTimeline, timeline, sizeof(lastTimeline));
+    lastCorrelationId = command.correlationId;
+    client = nullptr;
+
+    state.store((uint8_t)ReSessionState::IDLE, std::memory_order_release);
+}
+
+void ReCommandSession::onConnected()
+{
+    if (ReSessionState::CONNECTING != getState())
+    {
+        return;
+    }
+
+    bot->state = ReBotState::CONNECTED;
+
+    if (gattCache->get(*bot, handles))
+    {
+        subscribe();
+    }
+    else if (transition(ReSessionState::CONNECTING, ReSessionState::DISCOVERING))
+    {
+        discover();
+    }
+}
+
+void ReCommandSession::onConnectFailed(int reason)
+{
+    if (ReSessionState::CONNECTING == getState())
+    {
+        logger.error(RE_TAG, "Bot %d: connect failed, reason = %d", bot->id, reason);
+        fail("connect failed");
+    }
+}
+
+void ReCommandSession::onDisconnected(int reason)
+{
+    if (!isIdle() && !isFinished())
+    {
+        fail("disconnected");
+    }
+}
+
+void ReCommandSession::onNotify(const uint8_t *data, size_t length)
+{
+    ReSessionState current = getState();
+
+    // The response may overtake the write confirmation
+    if (ReSessionState::WRITING != current && ReSessionState::AWAITING_NOTIFY != current)
+    {
+        return;
+    }
+
+    resultLength = std::min(length, sizeof(result));
+    memcpy(result, data, resultLength);
+
+    if (!transition(current, ReSessionState::DONE))
+    {
+        transition(ReSessionState::AWAITING_NOTIFY, ReSessionState::DONE);
+    }
+}
+
+const char *ReCommandSession::stateName(ReSessionState state)
+{
+    switch (state)
+    {
+        case ReSessionState::IDLE:              return "idle";
+        case ReSessionState::SCAN_HIT:          return "scan_hit";
+        case ReSessionState::CONNECTING:        return "connecting";
+        case ReSessionState::DISCOVERING:       return "discovering";
+        case ReSessionState::SUBSCRIBING:       return "subscribing";
+        case ReSessionState::SUBSCRIBED:        return "subscribed";
+        case ReSessionState::WRITING:           return "writing";
+        case ReSessionState::AWAITING_NOTIFY:   return "awaiting_notify";
+        case ReSessionState::DONE:              return "done";
+        case ReSessionState::FAILED:            return "failed";
+        default:                                return "unknown";
+    }
+}
+
+bool ReCommandSession::transition(ReSessionState from, ReSessionState to)
+{
+    uint8_t expected = (uint8_t)from;
+
+    if (!state.compare_exchange_strong(expected, (uint8_t)to, std::memory_order_acq_rel))
+    {
+        return false;
+    }
+
+    timeline[(size_t)to] = micros() - startMicros;
+    stateSince = millis();
+
+    return true;
+}
+
+bool ReCommandSession::fail(const char *reason)
+{
+    const char *none = nullptr;
+
+    // Only the first failure goes on, its reason is in place before the state says FAILED
+    if (!error.compare_exchange_strong(none, reason, std::memory_order_acq_rel))
+    {
+        return false;
+    }
+
+    uint8_t current = state.load(std::memory_order_acquire);
+
+    while ((uint8_t)ReSessionState::IDLE != current && (uint8_t)ReSessionState::DONE != current && (uint8_t)ReSessionState::FAILED != current)
+    {
+        if (state.compare_exchange_weak(current, (uint8_t)ReSessionState::FAILED, std::memory_order_acq_rel))
+        {
+            timeline[(size_t)ReSessionState::FAILED] = micros() - startMicros;
+            stateSince = millis();
+            return true;
+        }
+    }
+
+    // Finished meanwhile, the result stands
+    error.store(nullptr, std::memory_order_release);
+    return false;
+}
+
+/** Resolve the Switchbot service handles, only done on a GATT cache miss */
+void ReCommandSession::discover()
+{
+    logger.info(RE_TAG, "Bot %d: discovering Switchbot service", bot->id);
+
+    handles = ReGattHandles();
+    serviceStart = serviceEnd = notifyEnd = 0;
+
+    if (0 != ble_gattc_disc_svc_by_uuid(client->getConnHandle(), serviceUUID.getBase(), ReCommandSession::onServiceDiscovered, this))
+    {
+        fail("discovery not started");
+    }
+}
+
+/** Subscribe by writing the descriptor directly, notifications are received by handle */
+void ReCommandSession::subscribe()
+{
+    ReSessionState current = getState();
+
+    if (!transition(current, ReSessionState::SUBSCRIBING))
+    {
+        return;
+    }
+
+    uint8_t cccd[2] = { (uint8_t)(handles.cccdValue & 0xFF), (uint8_t)(handles.cccdValue >> 8) };
+
+    if (0 != ble_gattc_write_flat(client->getConnHandle(), handles.cccd, cccd, sizeof(cccd), ReCommandSession::onSubscribed, this))
+    {
+        fail("subscribe not started");
+    }
+}
+
+void ReCommandSession::write()
+{
+    if (!transition(ReSessionState::SUBSCRIBED, ReSessionState::WRITING))
+    {
+        return;
+    }
+
+    if (0 != ble_gattc_write_flat(client->getConnHandle(), handles.control, frame, frameLength, ReCommandSession::onWritten, this))
+    {
+        fail("write not started");
+    }
+}
+
+int ReCommandSession::onServiceDiscovered(uint16_t conn_handle, const ble_gatt_error *error, const ble_gatt_svc *service, void *arg)
+{
+    ReCommandSession *session = (ReCommandSession *)arg;
+
+    if (ReSessionState::DISCOVERING != session->getState())
+    {
+        return BLE_HS_EDONE;
+    }
+
+    if (0 == error->status)
+    {
+        session->serviceStart = service->start_handle;
+        session->serviceEnd = service->end_handle;
+        return 0;
+    }
+
+    if (BLE_HS_EDONE != error->status || 0 == session->serviceEnd)
+    {
+        logger.error(RE_TAG, "SwitchBot Bot service not found");
+        session->fail("service not found");
+        return error->status;
+    }
+
+    if (0 != ble_gattc_disc_all_chrs(conn_handle, session->serviceStart, session->serviceEnd, ReCommandSession::onCharacteristicDiscovered, session))
+    {
+        session->fail("discovery not started");
+    }
+
+    return 0;
+}
+
+int ReCommandSession::onCharacteristicDiscovered(uint16_t conn_handle, const ble_gatt_error *error, const ble_gatt_chr *chr, void *arg)
+{
+    ReCommandSession *session = (ReCommandSession *)arg;
+    ReGattHandles &handles = session->handles;
+
+    if (ReSessionState::DISCOVERING != session->getState())
+    {
+        return BLE_HS_EDONE;
+    }
+
+    if (0 == error->status)
+    {
+#ifdef RE_GATT_DEBUG
+        logger.debug(RE_TAG, "Characteristic 0x%04x, properties: 0x%02x", chr->val_handle, chr->properties);
+#endif
+
+        // Descriptors of the notify characteristic end right before the next characteristic
+        if (handles.notify && session->notifyEnd == session->serviceEnd && chr->def_handle > handles.notify)
+        {
+            session->notifyEnd = chr->def_handle - 1;
+        }
+
+        // Type: write, write without response
+        if (0 == ble_uuid_cmp(&chr->uuid.u, controlCharacteristicUUID.getBase()) && (chr->properties & BLE_GATT_CHR_PROP_WRITE))
+        {
+            handles.control = chr->val_handle;
+        }
+        // Type: notify
+        else if (0 == ble_uuid_cmp(&chr->uuid.u, notifyCharacteristicUUID.getBase()))
+        {
+            handles.notify = chr->val_handle;
+            session->notifyEnd = session->serviceEnd;
+
+            /** Prefer notifications, indications are used only when the Bot cannot notify */
+            if (chr->properties & BLE_GATT_CHR_PROP_NOTIFY)
+            {
+                handles.cccdValue = 0x0001;
+            }
+            else if (chr->properties & BLE_GATT_CHR_PROP_INDICATE)
+            {
+                handles.cccdValue = 0x0002;
+            }
+        }
+
+        return 0;
+    }
+
+    if (BLE_HS_EDONE != error->status || !handles.control || !handles.notify)
+    {
+        logger.error(RE_TAG, "SwitchBot Bot characteristics not found");
+        session->fail("characteristics not found");
+        return error->status;
+    }
+
+    if (0 != ble_gattc_disc_all_dscs(conn_handle, handles.notify, session->notifyEnd, ReCommandSession::onDescriptorDiscovered, session))
+    {
+        session->fail("discovery not started");
+    }
+
+    return 0;
+}
+
+int ReCommandSession::onDescriptorDiscovered(uint16_t conn_handle, const ble_gatt_error *error, uint16_t chr_val_handle, const ble_gatt_dsc *dsc, void *arg)
+{
+    ReCommandSession *session = (ReCommandSession *)arg;
+    ReGattHandles &handles = session->handles;
+
+    if (ReSessionState::DISCOVERING != session->getState())
+    {
+        return BLE_HS_EDONE;
+    }
+
+    if (0 == error->status)
+    {
+        if (0 == ble_uuid_cmp(&dsc->uuid.u, cccdUUID.getBase()))
+        {
+            handles.cccd = dsc->handle;
+        }
+
+        return 0;
+    }
+
+    if (BLE_HS_EDONE != error->status || !handles.isValid())
+    {
+        logger.error(RE_TAG, "SwitchBot Bot notify descriptor not found");
+        session->fail("descriptor not found");
+        return error->status;
+    }
+
+    logger.info(RE_TAG, "Bot %d: GATT handles control: 0x%04x, notify: 0x%04x, cccd: 0x%04x",
+                session->bot->id, handles.control, handles.notify, handles.cccd);
+
+    session->gattCache->put(*session->bot, handles);
+    session->subscribe();
+
+    return 0;
+}
+
+int ReCommandSession::onSubscribed(uint16_t conn_handle, const ble_gatt_error *error, ble_gatt_attr *attr, void *arg)
+{
+    ReCommandSession *session = (ReCommandSession *)arg;
+
+    if (ReSessionState::SUBSCRIBING != session->getState())
+    {
+        return 0;
+    }
+
+    if (0 != error->status)
+    {
+        logger.error(RE_TAG, "Bot %d: subscribe failed, status = %d", session->bot->id, error->status);
+
+        // Handles may be stale (e.g. Bot firmware update), resolve them again on the next command
+        session->gattCache->invalidate(*session->bot);
+        session->fail("subscribe failed");
+        return 0;
+    }
+
+    if (session->transition(ReSessionState::SUBSCRIBING, ReSessionState::SUBSCRIBED))
+    {
+        session->write();
+    }
+
+    return 0;
+}
+
+int ReCommandSession::onWritten(uint16_t conn_handle, const ble_gatt_error *error, ble_gatt_attr *attr, void *arg)
+{
+    ReCommandSession *session = (ReCommandSession *)arg;
+
+    if (ReSessionState::WRITING != session->getState())
+    {
+        return 0;
+    }
+
+    if (0 != error->status)
+    {
+        logger.error(RE_TAG, "Bot %d: write failed, status = %d", session->bot->id, error->status);
+
+        session->gattCache->invalidate(*session->bot);
+        session->fail("write failed");
+        return 0;
+    }
+
+    session->transition(ReSessionState::WRITING, ReSessionState::AWAITING_NOTIFY);
+
+    return 0;
+}
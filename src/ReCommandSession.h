@@ -0,0 +1,114 @@
+#pragma once
+
+#include <atomic>
+#include <NimBLEDevice.h>
+#include "ReBotProtocol.h"
+#include "ReBotRegistry.h"
+#include "ReCommandQueue.h"
+#include "ReGattCache.h"
+
+static BLEUUID serviceUUID("cba20d00-224d-11e6-9fb8-0002a5d5c51b");
+static BLEUUID controlCharacteristicUUID("cba20002-224d-11e6-9fb8-0002a5d5c51b");
+static BLEUUID notifyCharacteristicUUID("cba20003-224d-11e6-9fb8-0002a5d5c51b");
+
+enum class ReSessionState : uint8_t
+{
+    IDLE = 0,
+    SCAN_HIT,           // command accepted, Bot is known from the scan
+    CONNECTING,         // asynchronous connect started
+    DISCOVERING,        // GATT handles not cached, discovering the Switchbot service
+    SUBSCRIBING,        // CCCD write sent
+    SUBSCRIBED,         // notifications enabled, ready to write the command
+    WRITING,            // command write sent
+    AWAITING_NOTIFY,    // command written, waiting for the Bot response
+    DONE,
+    FAILED,
+    COUNT
+};
+
+struct ReSessionTimeouts
+{
+    uint32_t connect = 5000;
+    uint32_t subscribe = 3000;  // includes service discovery on a GATT cache miss
+    uint32_t write = 2000;
+    uint32_t notify = 3000;
+};
+
+/**
+ * Asynchronous execution of one command on one Bot. Started from the BLE worker and advanced
+ * by the NimBLE host task callbacks (connect, GATT write / discovery completion, notification).
+ * Timeouts are checked from the BLE worker, every transition is a compare-and-swap so a late
+ * callback can not revive a session which has already failed.
+ */
+class ReCommandSession
+{
+public:
+    void begin(ReBot *bot, ReGattCache *cache, const ReSessionTimeouts *timeouts);
+
+    // BLE worker task
+    bool start(const ReCommand &command, NimBLEClient *client, bool connected);
+    void checkTimeout(uint32_t now);
+    void reset();
+
+    // NimBLE host task
+    void onConnected();
+    void onConnectFailed(int reason);
+    void onDisconnected(int reason);
+    void onNotify(const uint8_t *data, size_t length);
+
+    ReSessionState getState() const { return (ReSessionState)state.load(std::memory_order_acquire); }
+    bool isIdle() const { return ReSessionState::IDLE == getState(); }
+    bool isFinished() const { return ReSessionState::DONE == getState() || ReSessionState::FAILED == getState(); }
+
+    const ReCommand &getCommand() const { return command; }
+    const uint8_t *getResult() const { return result; }
+    size_t getResultLength() const { return resultLength; }
+    // Set only when the session ended FAILED
+    const char *getError() const { const char *reason = error.load(std::memory_order_acquire); return reason ? reason : ""; }
+    uint16_t getHandle() const { return handles.notify; }
+
+    // Microseconds from SCAN_HIT to entering each state of the last finished command, 0 when not visited
+    const uint32_t *getTimeline() const { return lastTimeline; }
+    uint32_t getLastCorrelationId() const { return lastCorrelationId; }
+
+    static const char *stateName(ReSessionState state);
+
+private:
+    bool transition(ReSessionState from, ReSessionState to);
+    // True when this call moved the session to FAILED, false when it had already finished
+    bool fail(const char *reason);
+
+    void discover();
+    void subscribe();
+    void write();
+
+    static int onServiceDiscovered(uint16_t conn_handle, const ble_gatt_error *error, const ble_gatt_svc *service, void *arg);
+    static int onCharacteristicDiscovered(uint16_t conn_handle, const ble_gatt_error *error, const ble_gatt_chr *chr, void *arg);
+    static int onDescriptorDiscovered(uint16_t conn_handle, const ble_gatt_error *error, uint16_t chr_val_handle, const ble_gatt_dsc *dsc, void *arg);
+    static int onSubscribed(uint16_t conn_handle, const ble_gatt_error *error, ble_gatt_attr *attr, void *arg);
+    static int onWritten(uint16_t conn_handle, const ble_gatt_error *error, ble_gatt_attr *attr, void *arg);
+
+    ReBot *bot = nullptr;
+    ReGattCache *gattCache = nullptr;
+    const ReSessionTimeouts *timeouts = nullptr;
+
+    std::atomic<uint8_t> state { (uint8_t)ReSessionState::IDLE };
+    ReCommand command;
+    uint8_t frame[RE_BOT_FRAME_MAX_LENGTH];             // command bytes as written, with the password key when set
+    size_t frameLength = 0;
+    NimBLEClient *client = nullptr;
+    ReGattHandles handles;
+    uint16_t serviceStart = 0;
+    uint16_t serviceEnd = 0;
+    uint16_t notifyEnd = 0;
+
+    uint8_t result[RE_NOTIFY_MAX_LENGTH];
+    size_t resultLength = 0;
+    std::atomic<const char *> error { nullptr };            // claimed by the first fail(), before the state says FAILED
+
+    uint32_t stateSince = 0;                                // millis() of the last transition, for timeouts
+    uint32_t startMicros = 0;
+    uint32_t timeline[(size_t)ReSessionState::COUNT] = {};
+    uint32_t lastTimeline[(size_t)ReSessionState::COUNT] = {};
+    uint32_t lastCorrelationId = 0;
+};
@@ -13,11 +13,28 @@ void configureStorage()
    config.configure("mqtt_port", 1883);
    config.configure("mqtt_user", "");
    config.configure("mqtt_pass", "");
-   config.configure("bot_mac", "f2:b2:02:06:1d:21");
+   config.configure("bot_mac", "f2:b2:02:06:1d:21"); // comma separated list, Bot ID is the position on the list
+   config.configure("bot_pass", ""); // comma separated list in the order of bot_mac, empty entry for a Bot without password
    config.configure("bot_scantime", 5000);
    config.configure("bot_txpower", 11);
+   config.configure("bot_idle", 30000); // keep connection open for this many ms after the last command
+   config.configure("bot_to_conn", 5000); // command state timeouts in ms
+   config.configure("bot_to_sub", 3000);
+   config.configure("bot_to_write", 2000);
+   config.configure("bot_to_notify", 3000);
+   config.configure("bot_retries", 2); // connect retries within the command deadline
+   config.configure("bot_retry_ms", 250); // first retry backoff, doubled for every next one
+   config.configure("bot_cb_fails", 3); // unreachable commands which open the circuit breaker
+   config.configure("bot_cb_open", 30000); // circuit breaker open time before the Bot is probed
+   config.configure("bot_direct", true); // connect by address, false waits for an advertisement after the command
+   config.configure("bot_whitelist", false); // let the BLE controller drop advertisements of unknown devices
+   config.configure("sensor_en", false); // decode Meter, Contact, Motion and Curtain advertisements
+   config.configure("ble_core", 0); // core the BLE worker task is pinned to
+   config.configure("ble_prio", 2); // FreeRTOS priority of the BLE worker task, the Arduino loop runs at 1
    config.configure("adm_pass", "admin");
    config.configure("adm_webserial", false);
+   config.configure("loop_stall_ms", 50); // main loop iterations longer than this are recorded as stalls
+   config.configure("loop_log", false); // log every main loop stall
 
    config.begin("BLEGateway", true); // Preload all values
 }
@@ -0,0 +1,184 @@
+#include "ReConnectionPool.h"
+
+void ReConnectionPool::begin(NimBLEClientCallbacks *callbacks, uint32_t idleTimeoutMs, uint32_t connectTimeoutMs)
+{
+    clientCallbacks = callbacks;
+    idleTimeout = idleTimeoutMs;
+    connectTimeout = connectTimeoutMs;
+
+    logger.debug(RE_TAG, "Connection pool: %d clients, idle timeout %ld ms", MYNEWT_VAL(BLE_MAX_CONNECTIONS), idleTimeout);
+}
+
+NimBLEClient *ReConnectionPool::prepare(ReBot &bot, bool &connected)
+{
+    connected = false;
+
+    // Hot connection, nothing to do
+    if (bot.client && bot.client->isConnected())
+    {
+        connected = true;
+        bot.reuses++;
+        touch(bot);
+
+        logger.info(RE_TAG, "Bot %d: reusing connection (%d reuses)", bot.id, bot.reuses);
+        return bot.client;
+    }
+
+    /** No client to reuse? Create a new one, take over the least recently used when all are taken */
+    if (!bot.client)
+    {
+        if (NimBLEDevice::getCreatedClientCount() >= MYNEWT_VAL(BLE_MAX_CONNECTIONS))
+        {
+            ReBot *victim = findLeastRecentlyUsed(bot);
+
+            if (!victim || victim->client->isConnected())
+            {
+                logger.error(RE_TAG, "Max clients reached - no more connections available");
+                return nullptr;
+            }
+
+            bot.client = takeOver(*victim, bot);
+        }
+        else
+        {
+            bot.client = createClient();
+        }
+
+        if (!bot.client)
+        {
+            logger.error(RE_TAG, "Failed to create client");
+            return nullptr;
+        }
+    }
+
+    touch(bot);
+
+    return bot.client;
+}
+
+void ReConnectionPool::touch(ReBot &bot)
+{
+    bot.lastUsed = millis();
+}
+
+bool ReConnectionPool::isAvailable(ReBot &bot)
+{
+    if (bot.client || NimBLEDevice::getCreatedClientCount() < MYNEWT_VAL(BLE_MAX_CONNECTIONS))
+    {
+        return true;
+    }
+
+    // Every client is busy or held, wait for one of them to finish
+    ReBot *victim = findLeastRecentlyUsed(bot);
+
+    if (!victim)
+    {
+        return false;
+    }
+
+    if (!victim->client->isConnected())
+    {
+        return true;
+    }
+
+    if (draining != victim)
+    {
+        logger.info(RE_TAG, "Disconnecting Bot %d to make room for Bot %d", victim->id, bot.id);
+
+        draining = victim;
+        victim->client->disconnect();
+    }
+
+    return false;
+}
+
+NimBLEClient *ReConnectionPool::takeOver(ReBot &victim, ReBot &bot)
+{
+    NimBLEClient *client = victim.client;
+
+    logger.info(RE_TAG, "Bot %d client handed over to Bot %d", victim.id, bot.id);
+
+    victim.client = nullptr;
+    victim.evictions++;
+    draining = nullptr;
+
+    if (ReBotState::CONNECTED == victim.state)
+    {
+        victim.state = ReBotState::FOUND;
+    }
+
+    // Attributes of the previous Bot are of no use, the GATT handles are cached per Bot
+    client->deleteServices();
+    client->setPeerAddress(NimBLEAddress(bot.address, bot.addressType));
+
+    return client;
+}
+
+void ReConnectionPool::loop()
+{
+    uint32_t now = millis();
+
+    for (ReBot &bot : ctx.getBotRegistry())
+    {
+        if (!bot.busy && bot.client && bot.client->isConnected() && (now - bot.lastUsed) > idleTimeout && !bot.isHeld(now))
+        {
+            logger.info(RE_TAG, "Bot %d: idle for %ld ms, disconnecting", bot.id, now - bot.lastUsed);
+
+            // Keep the client object, a reconnect reuses its service database
+            bot.client->disconnect();
+        }
+    }
+}
+
+NimBLEClient *ReConnectionPool::createClient()
+{
+    NimBLEClient *pClient = NimBLEDevice::createClient();
+
+    if (!pClient)
+    {
+        return nullptr;
+    }
+
+    logger.info(RE_TAG, "New client created");
+
+    pClient->setClientCallbacks(clientCallbacks, false);
+    /**
+     *  Set initial connection parameters:
+     *  These settings are safe for 3 clients to connect reliably, can go faster if you have less
+     *  connections. Timeout should be a multiple of the interval, minimum is 100ms.
+     *  Min interval: 12 * 1.25ms = 15, Max interval: 12 * 1.25ms = 15, 0 latency, 150 * 10ms = 1500ms timeout
+     */
+    pClient->setConnectionParams(12, 12, 0, 150);
+
+    /** Set how long we are willing to wait for the connection to complete (milliseconds), default is 30000. */
+    pClient->setConnectTimeout(connectTimeout);
+
+    return pClient;
+}
+
+ReBot *ReConnectionPool::findLeastRecentlyUsed(const ReBot &except)
+{
+    ReBot *victim = nullptr;
+    uint32_t now = millis();
+
+    for (ReBot &bot : ctx.getBotRegistry())
+    {
+        if (&bot == &except || bot.busy || !bot.client || bot.isHeld(now))
+        {
+            continue;
+        }
+
+        // Disconnected clients are free to take, prefer them over connected ones
+        if (!bot.client->isConnected())
+        {
+            return &bot;
+        }
+
+        if (!victim || (now - bot.lastUsed) > (now - victim->lastUsed))
+        {
+            victim = &bot;
+        }
+    }
+
+    return victim;
+}
@@ -0,0 +1,40 @@
+#pragma once
+
+#include <NimBLEDevice.h>
+#include "ReCommon.h"
+#include "ReContext.h"
+
+/**
+ * Keeps BLE clients of recently used Bots connected for an idle window, so a command
+ * to a hot Bot only costs the GATT write. When all BLE_MAX_CONNECTIONS are taken the
+ * least recently used client is disconnected and, once it is down, handed over to the
+ * new Bot: a deleted client keeps its slot until its disconnect completes, so a new
+ * one could not be created right away.
+ */
+class ReConnectionPool
+{
+public:
+    void begin(NimBLEClientCallbacks *callbacks, uint32_t idleTimeoutMs, uint32_t connectTimeoutMs);
+
+    // True when prepare() can give the Bot a client now, otherwise starts freeing one; the command waits meanwhile
+    bool isAvailable(ReBot &bot);
+    // Returns the client owned by the Bot or nullptr, connected is set for a hot connection which is already subscribed
+    NimBLEClient *prepare(ReBot &bot, bool &connected);
+    // Mark the connection as used now, restarts the idle window
+    void touch(ReBot &bot);
+    // Disconnect clients idle for longer than the idle timeout, call from the BLE worker
+    void loop();
+
+    uint32_t getIdleTimeout() const { return idleTimeout; }
+
+private:
+    NimBLEClient *createClient();
+    ReBot *findLeastRecentlyUsed(const ReBot &except);
+    NimBLEClient *takeOver(ReBot &victim, ReBot &bot);
+
+    ReContext ctx;
+    NimBLEClientCallbacks *clientCallbacks = nullptr;
+    uint32_t idleTimeout = 0;
+    uint32_t connectTimeout = 5000;
+    ReBot *draining = nullptr;              // victim whose disconnect has been started
+};
@@ -1,5 +1,7 @@
 #include "ReContext.h"
 
-bool ReContext::bleDeviceFound = false;
-bool ReContext::doConnect = false;
-std::string ReContext::doCommand = "570100";
\ No newline at end of file
+ReBotRegistry ReContext::botRegistry;
+ReCommandQueue ReContext::commandQueue;
+ReMetrics ReContext::metrics;
+ReSensorStore ReContext::sensors;
+ReEventBus ReContext::eventBus;
@@ -1,41 +1,50 @@
 #pragma once
 
+#include <Arduino.h>
 #include <string>
+#include "ReBotRegistry.h"
+#include "ReCommandQueue.h"
+#include "ReEventBus.h"
+#include "ReMetrics.h"
+#include "ReSensors.h"
 
 class ReContext
 {
     public:
 
     ReContext() = default;
-    
-    bool getDoConnect() {
-        return doConnect;
+
+    ReCommandQueue& getCommandQueue() {
+        return commandQueue;
     }
 
-    void setDoConnect(bool value) {
-        doConnect = value;
+    ReBotRegistry& getBotRegistry() {
+        return botRegistry;
     }
-    
-    std::string& getDoCommand() {
-        return doCommand;
+
+    ReMetrics& getMetrics() {
+        return metrics;
     }
 
-    void setDoCommand(const std::string& value) {
-        doCommand = value;
+    ReSensorStore& getSensors() {
+        return sensors;
     }
 
-    bool getBleDeviceFound() {
-        return bleDeviceFound;
+    ReEventBus& getEventBus() {
+        return eventBus;
     }
 
-    void setBleDeviceFound(bool value) {
-        bleDeviceFound = value;
+    // Bot has advertised recently, judged from the advertisement cache only
+    bool getBotPresent(uint8_t botId) {
+        ReBot* bot = botRegistry.get(botId);
+        return (nullptr != bot) && ReBotPresence::GONE != bot->getPresence(millis());
     }
 
     private:
 
-    static bool bleDeviceFound;
-    static bool doConnect;
-    static std::string doCommand;
+    static ReBotRegistry botRegistry;
+    static ReCommandQueue commandQueue;
+    static ReMetrics metrics;
+    static ReSensorStore sensors;
+    static ReEventBus eventBus;
 };
-
@@ -0,0 +1,286 @@
+#include "ReEventBus.h"
+#include "ReCommon.h"
+
+bool ReEventBus::begin()
+{
+    if (!pool.begin())
+    {
+        logger.error(RE_TAG, "Event bus: pool not created");
+        return false;
+    }
+
+    return true;
+}
+
+bool ReEventBus::subscribe(const char *name, ReEventHandler handler, uint32_t delayMs, UBaseType_t taskPriority)
+{
+    if (sinkCount >= RE_MAX_SINKS)
+    {
+        logger.error(RE_TAG, "Event bus: no room for the %s sink", name);
+        return false;
+    }
+
+    if (delayMs && taskPriority > 0)
+    {
+        logger.error(RE_TAG, "Event bus: delayed %s sink must run from loop()", name);
+        return false;
+    }
+
+    ReEventSink &sink = sinks[sinkCount];
+    sink.bus = this;
+    sink.name = name;
+    sink.handler = handler;
+    sink.delayMs = delayMs;
+    sink.queue = delayMs ? nullptr : xQueueCreate(RE_SINK_QUEUE_SIZE, sizeof(ReResultHandle));
+
+    if (!delayMs && !sink.queue)
+    {
+        logger.error(RE_TAG, "Event bus: %s sink queue not created", name);
+        return false;
+    }
+
+    if (taskPriority > 0)
+    {
+        if (pdPASS != xTaskCreatePinnedToCore(ReEventBus::sinkTask, name, RE_SINK_TASK_STACK_SIZE, &sink, taskPriority, &sink.task, tskNO_AFFINITY))
+        {
+            logger.error(RE_TAG, "Event bus: %s sink task not created", name);
+            return false;
+        }
+    }
+
+    sinkCount++;
+
+    logger.debug(RE_TAG, "Event bus: %s sink subscribed%s", name, sink.task ? " on its own task" : "");
+    return true;
+}
+
+void ReEventBus::publish(const ReCommand &command, const ReBotResult &result)
+{
+    ReResultHandle handle = pool.acquire();
+    ReResultEvent *event = pool.get(handle);
+
+    // Can not happen while the pool covers every sink queue, see RE_RESULT_POOL_SIZE
+    if (!event)
+    {
+        logger.error(RE_TAG, "Event bus: pool empty, result of command %ld lost", command.correlationId);
+        return;
+    }
+
+    event->command = command;
+    event->result = result;
+    ReBotProtocol::toText(result, event->text, sizeof(event->text));
+    event->publishedAt = micros();
+
+    // One reference per sink on top of the publisher one, until all the sinks have their copy
+    pool.retain(handle, sinkCount);
+
+    for (size_t i = 0; i < sinkCount; i++)
+    {
+        ReEventSink &sink = sinks[i];
+
+        // Only the latest result of the Bot matters, an older one still pending gives its reference back
+        if (sink.delayMs)
+        {
+            ReResultHandle &slot = sink.latest[command.botId < RE_MAX_BOTS ? command.botId : RE_MAX_BOTS];
+
+            if (slot.isValid())
+            {
+                pool.release(slot);
+                sink.coalesced.fetch_add(1, std::memory_order_relaxed);
+            }
+
+            slot = handle;
+            continue;
+        }
+
+        // Same task as the handler, make room instead of dropping
+        if (!sink.task)
+        {
+            while (0 == uxQueueSpacesAvailable(sink.queue) && deliver(sink, 0))
+            {
+            }
+        }
+
+        if (pdPASS != xQueueSend(sink.queue, &handle, 0))
+        {
+            sink.dropped.fetch_add(1, std::memory_order_relaxed);
+            pool.release(handle);
+
+            logger.warn(RE_TAG, "Event bus: %s sink is full, result of command %ld dropped", sink.name, command.correlationId);
+            continue;
+        }
+
+        uint32_t waiting = uxQueueMessagesWaiting(sink.queue);
+
+        if (waiting > sink.highWater.load(std::memory_order_relaxed))
+        {
+            sink.highWater.store(waiting, std::memory_order_relaxed);
+        }
+    }
+
+    pool.release(handle);
+}
+
+void ReEventBus::loop()
+{
+    for (size_t i = 0; i < sinkCount; i++)
+    {
+        if (sinks[i].delayMs)
+        {
+            deliverDelayed(sinks[i]);
+        }
+        else if (!sinks[i].task)
+        {
+            while (deliver(sinks[i], 0))
+            {
+            }
+        }
+    }
+}
+
+bool ReEventBus::deliver(ReEventSink &sink, TickType_t wait)
+{
+    ReResultHandle handle;
+
+    if (pdPASS != xQueuePeek(sink.queue, &handle, wait))
+    {
+        return false;
+    }
+
+    const ReResultEvent *event = pool.get(handle);
+
+    xQueueReceive(sink.queue, &handle, 0);
+
+    // Only with a reference counting bug, skip it rather than show another result
+    if (!event)
+    {
+        return true;
+    }
+
+    sink.latency.record(micros() - event->publishedAt);
+    sink.handler(*event);
+    sink.delivered.fetch_add(1, std::memory_order_relaxed);
+
+    pool.release(handle);
+    return true;
+}
+
+void ReEventBus::deliverDelayed(ReEventSink &sink)
+{
+    uint32_t delay = sink.delayMs * 1000;
+
+    for (ReResultHandle &slot : sink.latest)
+    {
+        if (!slot.isValid())
+        {
+            continue;
+        }
+
+        const ReResultEvent *event = pool.get(slot);
+        uint32_t age = event ? micros() - event->publishedAt : 0;
+
+        if (event && age < delay)
+        {
+            continue;
+        }
+
+        ReResultHandle handle = slot;
+        slot = ReResultHandle();
+
+        if (event)
+        {
+            sink.latency.record(age - delay);
+            sink.handler(*event);
+            sink.delivered.fetch_add(1, std::memory_order_relaxed);
+
+            pool.release(handle);
+        }
+    }
+}
+
+uint32_t ReEventBus::getDepth(size_t index) const
+{
+    const ReEventSink &sink = sinks[index];
+
+    if (!sink.delayMs)
+    {
+        return uxQueueMessagesWaiting(sink.queue);
+    }
+
+    uint32_t pending = 0;
+
+    for (const ReResultHandle &slot : sink.latest)
+    {
+        pending += slot.isValid() ? 1 : 0;
+    }
+
+    return pending;
+}
+
+void ReEventBus::sinkTask(void *arg)
+{
+    ReEventSink *sink = (ReEventSink *)arg;
+
+    for (;;)
+    {
+        sink->bus->deliver(*sink, portMAX_DELAY);
+    }
+}
+
+void ReEventBus::print(Print &out) const
+{
+    out.print("# HELP blegateway_sink_latency_seconds Command result published until handled, per sink\n");
+    out.print("# TYPE blegateway_sink_latency_seconds histogram\n");
+
+    char label[32];
+
+    for (size_t i = 0; i < sinkCount; i++)
+    {
+        snprintf(label, sizeof(label), "sink=\"%s\"", sinks[i].name);
+        sinks[i].latency.print(out, "blegateway_sink_latency_seconds", label);
+    }
+
+    out.print("# TYPE blegateway_sink_delivered_total counter\n");
+
+    for (size_t i = 0; i < sinkCount; i++)
+    {
+        out.printf("blegateway_sink_delivered_total{sink=\"%s\"} %lu\n", sinks[i].name, sinks[i].delivered.load(std::memory_order_relaxed));
+    }
+
+    out.print("# TYPE blegateway_sink_dropped_total counter\n");
+
+    for (size_t i = 0; i < sinkCount; i++)
+    {
+        out.printf("blegateway_sink_dropped_total{sink=\"%s\"} %lu\n", sinks[i].name, sinks[i].dropped.load(std::memory_order_relaxed));
+    }
+
+    out.print("# TYPE blegateway_sink_coalesced_total counter\n");
+
+    for (size_t i = 0; i < sinkCount; i++)
+    {
+        out.printf("blegateway_sink_coalesced_total{sink=\"%s\"} %lu\n", sinks[i].name, sinks[i].coalesced.load(std::memory_order_relaxed));
+    }
+
+    out.print("# TYPE blegateway_sink_queue_depth gauge\n");
+
+    for (size_t i = 0; i < sinkCount; i++)
+    {
+        out.printf("blegateway_sink_queue_depth{sink=\"%s\"} %lu\n", sinks[i].name, getDepth(i));
+    }
+
+    out.print("# TYPE blegateway_sink_queue_high_water gauge\n");
+
+    for (size_t i = 0; i < sinkCount; i++)
+    {
+        out.printf("blegateway_sink_queue_high_water{sink=\"%s\"} %lu\n", sinks[i].name, sinks[i].highWater.load(std::memory_order_relaxed));
+    }
+
+    out.print("# TYPE blegateway_result_pool_in_use gauge\n");
+    out.printf("blegateway_result_pool_in_use %lu\n", pool.getInUse());
+    out.print("# TYPE blegateway_result_pool_high_water gauge\n");
+    out.printf("blegateway_result_pool_high_water %lu\n", pool.getHighWater());
+    out.print("# TYPE blegateway_result_pool_exhausted_total counter\n");
+    out.printf("blegateway_result_pool_exhausted_total %lu\n", pool.getExhausted());
+    out.print("# TYPE blegateway_result_pool_stale_total counter\n");
+    out.printf("blegateway_result_pool_stale_total %lu\n", pool.getStale());
+}
@@ -0,0 +1,79 @@
+#pragma once
+
+#include <Arduino.h>
+#include <atomic>
+#include <functional>
+#include <freertos/FreeRTOS.h>
+#include <freertos/queue.h>
+#include <freertos/task.h>
+#include "ReMetrics.h"
+#include "ReResultPool.h"
+
+#define RE_MAX_SINKS 5
+#define RE_SINK_QUEUE_SIZE 3            // results waiting per sink, a full sink on its own task only drops its own copy
+#define RE_SINK_SLOTS (RE_MAX_BOTS + 1) // latest result per Bot of a delayed sink, the last slot for unknown Bots
+#define RE_SINK_TASK_STACK_SIZE 4096
+
+// A queued sink holds its queue plus the event in its handler, a delayed one its slots; one more is being published
+#define RE_SINK_MAX_HELD ((RE_SINK_QUEUE_SIZE + 1) > RE_SINK_SLOTS ? (RE_SINK_QUEUE_SIZE + 1) : RE_SINK_SLOTS)
+static_assert(RE_RESULT_POOL_SIZE >= RE_MAX_SINKS * RE_SINK_MAX_HELD + 1, "Result pool smaller than the sink queues");
+
+typedef std::function<void(const ReResultEvent&)> ReEventHandler;
+
+class ReEventBus;
+
+struct ReEventSink
+{
+    ReEventBus *bus = nullptr;
+    const char *name = nullptr;
+    ReEventHandler handler;
+    uint32_t delayMs = 0;               // held back this long after publishing, loop() sinks only
+    QueueHandle_t queue = nullptr;
+    TaskHandle_t task = nullptr;        // own task, otherwise handled from loop()
+    ReResultHandle latest[RE_SINK_SLOTS];   // delayed sinks, latest result per Bot instead of the queue
+
+    ReHistogram latency;                // published until handled, the delay not included
+    std::atomic<uint32_t> delivered { 0 };
+    std::atomic<uint32_t> dropped { 0 };
+    std::atomic<uint32_t> coalesced { 0 };  // replaced by a newer result of the same Bot before it was due
+    std::atomic<uint32_t> highWater { 0 };
+};
+
+/**
+ * Fan-out of the command results to the HTTP waiters, MQTT, Matter and the LED. Events come
+ * from the result pool and are reference counted, every sink gets a handle in its own queue
+ * and releases it when done, so no sink can read a record reused by another result. Sinks which
+ * can block (MQTT) run on their own task, a slow one fills its own queue and drops its own copies
+ * only. Sinks handled from loop() never drop: publish() runs on the main loop too and drains a
+ * full one first. Delayed sinks (the Matter switch and LED reset) only act on the latest result
+ * of every Bot, so they keep one slot per Bot instead of a queue.
+ */
+class ReEventBus
+{
+public:
+    bool begin();
+
+    // Setup only, before the first publish; a task priority above 0 runs the sink on its own task
+    bool subscribe(const char *name, ReEventHandler handler, uint32_t delayMs = 0, UBaseType_t taskPriority = 0);
+
+    // Main loop
+    void publish(const ReCommand &command, const ReBotResult &result);
+    void loop();
+
+    size_t getSinkCount() const { return sinkCount; }
+    const ReEventSink &getSink(size_t index) const { return sinks[index]; }
+    uint32_t getDepth(size_t index) const;
+    const ReResultPool &getPool() const { return pool; }
+
+    void print(Print &out) const;
+
+private:
+    bool deliver(ReEventSink &sink, TickType_t wait);
+    void deliverDelayed(ReEventSink &sink);
+
+    static void sinkTask(void *arg);
+
+    ReResultPool pool;
+    ReEventSink sinks[RE_MAX_SINKS];
+    size_t sinkCount = 0;
+};
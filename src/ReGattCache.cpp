@@ -0,0 +1,107 @@
+#include "ReGattCache.h"
+#include "ReCommon.h"
+#include <Preferences.h>
+
+#define RE_GATT_NVS_NAMESPACE "BLEGattCache"
+
+void ReGattCache::begin(ReBotRegistry &registry)
+{
+    Preferences prefs;
+
+    if (!prefs.begin(RE_GATT_NVS_NAMESPACE, true))
+    {
+        return;
+    }
+
+    for (ReBot &bot : registry)
+    {
+        char key[13];
+        nvsKey(bot, key);
+
+        ReGattHandles stored;
+
+        if (prefs.getBytesLength(key) == sizeof(stored) && prefs.getBytes(key, &stored, sizeof(stored)) == sizeof(stored))
+        {
+            entries[bot.id] = stored;
+
+            logger.debug(RE_TAG, "Bot %d: GATT handles loaded from NVS, control: 0x%04x, notify: 0x%04x, cccd: 0x%04x",
+                         bot.id, stored.control, stored.notify, stored.cccd);
+        }
+    }
+
+    prefs.end();
+}
+
+bool ReGattCache::get(const ReBot &bot, ReGattHandles &handles)
+{
+    if (bot.id >= RE_MAX_BOTS)
+    {
+        return false;
+    }
+
+    handles = entries[bot.id];
+    return handles.isValid();
+}
+
+void ReGattCache::put(const ReBot &bot, const ReGattHandles &handles)
+{
+    if (bot.id >= RE_MAX_BOTS)
+    {
+        return;
+    }
+
+    entries[bot.id] = handles;
+    dirty[bot.id] = true;
+}
+
+void ReGattCache::invalidate(const ReBot &bot)
+{
+    if (bot.id >= RE_MAX_BOTS || !entries[bot.id].isValid())
+    {
+        return;
+    }
+
+    entries[bot.id] = ReGattHandles();
+    dirty[bot.id] = true;
+}
+
+void ReGattCache::flush(ReBotRegistry &registry)
+{
+    for (ReBot &bot : registry)
+    {
+        if (!dirty[bot.id])
+        {
+            continue;
+        }
+
+        dirty[bot.id] = false;
+
+        char key[13];
+        nvsKey(bot, key);
+
+        Preferences prefs;
+
+        if (!prefs.begin(RE_GATT_NVS_NAMESPACE, false))
+        {
+            continue;
+        }
+
+        if (entries[bot.id].isValid())
+        {
+            prefs.putBytes(key, &entries[bot.id], sizeof(ReGattHandles));
+        }
+        else
+        {
+            logger.warn(RE_TAG, "Bot %d: GATT handle cache invalidated", bot.id);
+            prefs.remove(key);
+        }
+
+        prefs.end();
+    }
+}
+
+void ReGattCache::nvsKey(const ReBot &bot, char *key)
+{
+    // NVS keys are limited to 15 characters, use the 12 hex digits of the MAC address
+    snprintf(key, 13, "%012llx", (unsigned long long)bot.address);
+}
@@ -0,0 +1,41 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include "ReBotRegistry.h"
+
+// Attribute handles of the Switchbot service, enough to command the Bot without service discovery
+struct ReGattHandles
+{
+    uint16_t control = 0;       // control characteristic value handle, write
+    uint16_t notify = 0;        // notify characteristic value handle
+    uint16_t cccd = 0;          // client characteristic configuration descriptor of the notify characteristic
+    uint16_t cccdValue = 0;     // 0x0001 notifications, 0x0002 indications
+
+    bool isValid() const { return control != 0 && notify != 0 && cccd != 0 && cccdValue != 0; }
+};
+
+/**
+ * Per Bot cache of the resolved GATT handles, persisted in NVS under the Bot MAC address.
+ * Handles are only dropped when a write to them fails, the next command then runs the
+ * discovery again. get(), put() and invalidate() only touch RAM and are safe to call from
+ * the NimBLE host task, NVS is updated by flush() from the BLE worker.
+ */
+class ReGattCache
+{
+public:
+    void begin(ReBotRegistry &registry);
+
+    bool get(const ReBot &bot, ReGattHandles &handles);
+    void put(const ReBot &bot, const ReGattHandles &handles);
+    void invalidate(const ReBot &bot);
+
+    // Write changed entries to NVS
+    void flush(ReBotRegistry &registry);
+
+private:
+    static void nvsKey(const ReBot &bot, char *key);
+
+    std::array<ReGattHandles, RE_MAX_BOTS> entries;
+    std::array<bool, RE_MAX_BOTS> dirty {};
+};
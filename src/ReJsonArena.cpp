@@ -0,0 +1,92 @@
+#include "ReJsonArena.h"
+#include <cstring>
+
+ArduinoJson::Allocator *ReJsonArena::begin()
+{
+    used = 0;
+    last = nullptr;
+    documents++;
+
+    return this;
+}
+
+void *ReJsonArena::allocate(size_t size)
+{
+    size_t need = HEADER + align(size);
+
+    if (used + need > sizeof(buffer))
+    {
+        overflows++;
+        return nullptr;
+    }
+
+    uint8_t *block = buffer + used;
+    *(uint32_t *)block = size;
+
+    used += need;
+    last = block + HEADER;
+
+    if (used > peak)
+    {
+        peak = used;
+    }
+
+    return last;
+}
+
+void ReJsonArena::deallocate(void *pointer)
+{
+    // Memory of the other blocks comes back with the next begin()
+    if (pointer && pointer == last)
+    {
+        used = last - HEADER - buffer;
+        last = nullptr;
+    }
+}
+
+void *ReJsonArena::reallocate(void *pointer, size_t size)
+{
+    if (!pointer)
+    {
+        return allocate(size);
+    }
+
+    uint8_t *block = (uint8_t *)pointer;
+    size_t oldSize = *(uint32_t *)(block - HEADER);
+
+    // Last block grows or shrinks in place
+    if (block == last)
+    {
+        size_t start = block - buffer;
+
+        if (start + align(size) > sizeof(buffer))
+        {
+            overflows++;
+            return nullptr;
+        }
+
+        *(uint32_t *)(block - HEADER) = size;
+        used = start + align(size);
+
+        if (used > peak)
+        {
+            peak = used;
+        }
+
+        return block;
+    }
+
+    if (size <= oldSize)
+    {
+        return block;
+    }
+
+    void *moved = allocate(size);
+
+    if (moved)
+    {
+        memcpy(moved, block, oldSize);
+    }
+
+    return moved;
+}
@@ -0,0 +1,41 @@
+#pragma once
+
+#include <ArduinoJson.h>
+#include <cstddef>
+#include <cstdint>
+
+#define RE_JSON_ARENA_SIZE 8192     // largest JSON document of one HTTP handler
+
+/**
+ * ArduinoJson allocator over a fixed buffer, so building a response document never touches the
+ * heap. Allocation only moves a pointer forward, begin() takes the whole buffer back for the next
+ * document. Only for documents which live within one HTTP handler on the AsyncTCP task; a full
+ * arena makes the document overflow instead of falling back to the heap.
+ */
+class ReJsonArena : public ArduinoJson::Allocator
+{
+public:
+    // Empty the arena for a new document
+    ArduinoJson::Allocator *begin();
+
+    void *allocate(size_t size) override;
+    void deallocate(void *pointer) override;
+    void *reallocate(void *pointer, size_t size) override;
+
+    uint32_t getDocuments() const { return documents; }
+    size_t getPeak() const { return peak; }
+    uint32_t getOverflows() const { return overflows; }
+
+private:
+    // Block size is kept in front of every block, aligned for doubles and 64-bit integers
+    static constexpr size_t HEADER = 8;
+    static size_t align(size_t size) { return (size + 7) & ~(size_t)7; }
+
+    alignas(8) uint8_t buffer[RE_JSON_ARENA_SIZE];
+    size_t used = 0;
+    uint8_t *last = nullptr;        // last block, the only one which can grow in place or be given back
+
+    uint32_t documents = 0;
+    size_t peak = 0;
+    uint32_t overflows = 0;
+};
@@ -0,0 +1,181 @@
+#include "ReLoopProfiler.h"
+#include "ReCommon.h"
+
+void ReLoopProfiler::begin(uint32_t stallMs, bool logStalls)
+{
+    this->logStalls = logStalls;
+
+    cyclesPerUs = ESP.getCpuFreqMHz();
+
+    // The cycle counter wraps after 2^32 cycles, 17 s at 240 MHz
+    uint64_t cycles = (uint64_t)stallMs * 1000 * cyclesPerUs;
+    stallCycles = cycles < UINT32_MAX ? (uint32_t)cycles : UINT32_MAX;
+}
+
+void ReLoopProfiler::start()
+{
+    iterationStart = ESP.getCycleCount();
+    stageStart = iterationStart;
+}
+
+void ReLoopProfiler::mark(ReLoopStage stage)
+{
+    uint32_t now = ESP.getCycleCount();
+
+    stageCycles[(size_t)stage] = now - stageStart;
+    stageStart = now;
+}
+
+void ReLoopProfiler::end()
+{
+    uint32_t cycles = stageStart - iterationStart;
+    size_t worst = 0;
+
+    ReLoopTotals &total = totals.beginWrite();
+
+    total.iterations++;
+    total.cycles += cycles;
+
+    if (cycles > total.maxCycles)
+    {
+        total.maxCycles = cycles;
+    }
+
+    for (size_t i = 0; i < (size_t)ReLoopStage::COUNT; i++)
+    {
+        total.stageCycles[i] += stageCycles[i];
+
+        if (stageCycles[i] > total.stageMax[i])
+        {
+            total.stageMax[i] = stageCycles[i];
+        }
+
+        if (stageCycles[i] > stageCycles[worst])
+        {
+            worst = i;
+        }
+    }
+
+    totals.endWrite();
+
+    if (cycles < stallCycles)
+    {
+        return;
+    }
+
+    uint32_t count = stallCount.load(std::memory_order_relaxed);
+    ReSeqSlot<ReLoopStall> &slot = stalls[count % RE_LOOP_STALLS];
+    ReLoopStall &stall = slot.beginWrite();
+
+    stall.at = millis();
+    stall.totalUs = toMicros(cycles);
+    stall.worst = (ReLoopStage)worst;
+
+    for (size_t i = 0; i < (size_t)ReLoopStage::COUNT; i++)
+    {
+        stall.stageUs[i] = toMicros(stageCycles[i]);
+    }
+
+    slot.endWrite();
+    stallCount.store(count + 1, std::memory_order_release);
+
+    // Logged after the measurement, the logging itself is counted in the next iteration
+    if (logStalls)
+    {
+        logger.warn(RE_TAG, "Loop stall: %lu us, worst stage %s %lu us", stall.totalUs,
+                    stageName(stall.worst), stall.stageUs[worst]);
+    }
+}
+
+bool ReLoopProfiler::readStall(size_t index, ReLoopStall &stall) const
+{
+    uint32_t count = stallCount.load(std::memory_order_acquire);
+
+    if (index >= RE_LOOP_STALLS || index >= count)
+    {
+        return false;
+    }
+
+    stalls[(count - 1 - index) % RE_LOOP_STALLS].read(stall);
+
+    return true;
+}
+
+void ReLoopProfiler::toJson(JsonObject doc) const
+{
+    ReLoopTotals total;
+    totals.read(total);
+    uint32_t count = total.iterations;
+
+    doc["iterations"] = count;
+    doc["avg_us"] = count ? toMicros(total.cycles / count) : 0;
+    doc["max_us"] = toMicros(total.maxCycles);
+    doc["stall_threshold_us"] = toMicros(stallCycles);
+    doc["stalls"] = stallCount.load(std::memory_order_relaxed);
+
+    JsonObject stages = doc["stages"].to<JsonObject>();
+
+    for (size_t i = 0; i < (size_t)ReLoopStage::COUNT; i++)
+    {
+        JsonObject item = stages[stageName((ReLoopStage)i)].to<JsonObject>();
+        item["avg_us"] = count ? toMicros(total.stageCycles[i] / count) : 0;
+        item["max_us"] = toMicros(total.stageMax[i]);
+    }
+
+    JsonArray recent = doc["recent_stalls"].to<JsonArray>();
+    ReLoopStall stall;
+
+    for (size_t i = 0; readStall(i, stall); i++)
+    {
+        JsonObject item = recent.add<JsonObject>();
+        item["at_ms"] = stall.at;
+        item["us"] = stall.totalUs;
+        item["worst"] = stageName(stall.worst);
+
+        JsonObject stallStages = item["stages"].to<JsonObject>();
+
+        for (size_t s = 0; s < (size_t)ReLoopStage::COUNT; s++)
+        {
+            stallStages[stageName((ReLoopStage)s)] = stall.stageUs[s];
+        }
+    }
+}
+
+void ReLoopProfiler::print(Print &out) const
+{
+    ReLoopTotals total;
+    totals.read(total);
+    uint32_t count = total.iterations;
+
+    out.printf("Loop: %lu iterations, avg %lu us, max %lu us, %lu stalls over %lu us\n", count,
+               count ? toMicros(total.cycles / count) : 0, toMicros(total.maxCycles),
+               stallCount.load(std::memory_order_relaxed), toMicros(stallCycles));
+
+    for (size_t i = 0; i < (size_t)ReLoopStage::COUNT; i++)
+    {
+        out.printf("  %-10s avg %lu us, max %lu us\n", stageName((ReLoopStage)i),
+                   count ? toMicros(total.stageCycles[i] / count) : 0, toMicros(total.stageMax[i]));
+    }
+
+    ReLoopStall stall;
+
+    for (size_t i = 0; readStall(i, stall); i++)
+    {
+        out.printf("  stall at %lu ms: %lu us, worst %s %lu us\n", stall.at, stall.totalUs,
+                   stageName(stall.worst), stall.stageUs[(size_t)stall.worst]);
+    }
+}
+
+const char *ReLoopProfiler::stageName(ReLoopStage stage)
+{
+    switch (stage)
+    {
+        case ReLoopStage::ESPCONNECT:   return "espconnect";
+        case ReLoopStage::TASKS:        return "tasks";
+        case ReLoopStage::LED:          return "led";
+        case ReLoopStage::SERVER:       return "server";
+        case ReLoopStage::BLE_EVENTS:   return "ble_events";
+        case ReLoopStage::RESULTS:      return "results";
+        default:                        return "unknown";
+    }
+}
@@ -0,0 +1,81 @@
+#pragma once
+
+#include <Arduino.h>
+#include <ArduinoJson.h>
+#include <atomic>
+#include "ReSeqSlot.h"
+
+#define RE_LOOP_STALLS 8                // last stalls kept for the report
+
+// Stages of the Arduino loop(), in the order they run
+enum class ReLoopStage : uint8_t
+{
+    ESPCONNECT = 0,
+    TASKS,                              // Mycila tasks, Bot state and sensor publishing
+    LED,
+    SERVER,                             // HTTP waiter timeouts
+    BLE_EVENTS,                         // BLE worker mailbox
+    RESULTS,                            // event bus sinks run from the loop
+    COUNT
+};
+
+// One loop iteration over the stall threshold
+struct ReLoopStall
+{
+    uint32_t at = 0;                    // millis() at the end of the iteration
+    uint32_t totalUs = 0;
+    uint32_t stageUs[(size_t)ReLoopStage::COUNT] = {};
+    ReLoopStage worst = ReLoopStage::ESPCONNECT;
+};
+
+// Totals since boot, in cycles
+struct ReLoopTotals
+{
+    uint32_t iterations = 0;
+    uint64_t cycles = 0;
+    uint32_t maxCycles = 0;
+    uint64_t stageCycles[(size_t)ReLoopStage::COUNT] = {};
+    uint32_t stageMax[(size_t)ReLoopStage::COUNT] = {};
+};
+
+/**
+ * Always-on profiler of the Arduino loop(). Every stage is timed with the CPU cycle counter,
+ * a few cycles per mark(), so it stays on in production. Iterations over the stall threshold
+ * are kept in a ring with the time of every stage and optionally logged. Written by the main
+ * loop only, the totals and the stalls are ReSeqSlots read by the HTTP handler and the
+ * WebSerial command.
+ */
+class ReLoopProfiler
+{
+public:
+    void begin(uint32_t stallMs, bool logStalls);
+
+    // Main loop: start() first, mark() after every stage, end() last
+    void start();
+    void mark(ReLoopStage stage);
+    void end();
+
+    // Last stalls, newest first; false past the stored ones
+    bool readStall(size_t index, ReLoopStall &stall) const;
+
+    void toJson(JsonObject doc) const;
+    void print(Print &out) const;
+
+    static const char *stageName(ReLoopStage stage);
+
+private:
+    uint32_t toMicros(uint64_t cycles) const { return (uint32_t)(cycles / cyclesPerUs); }
+
+    uint32_t cyclesPerUs = 1;
+    uint32_t stallCycles = UINT32_MAX;
+    bool logStalls = false;
+
+    // Current iteration
+    uint32_t iterationStart = 0;
+    uint32_t stageStart = 0;
+    uint32_t stageCycles[(size_t)ReLoopStage::COUNT] = {};
+
+    ReSeqSlot<ReLoopTotals> totals;
+    ReSeqSlot<ReLoopStall> stalls[RE_LOOP_STALLS];
+    std::atomic<uint32_t> stallCount { 0 };
+};
@@ -0,0 +1,107 @@
+#include "ReMetrics.h"
+
+const uint32_t ReHistogram::bounds[RE_HISTOGRAM_BUCKETS] = {
+    1000, 2500, 5000, 10000, 25000, 50000, 100000, 250000,
+    500000, 1000000, 2500000, 5000000, 10000000, 30000000
+};
+
+#ifdef CONFIG_HEAP_USE_HOOKS
+static std::atomic<uint32_t> heapAllocations { 0 };
+
+// Called by the ESP-IDF heap on every allocation of every task, keep it to one atomic add
+extern "C" void esp_heap_trace_alloc_hook(void *, size_t, uint32_t)
+{
+    heapAllocations.fetch_add(1, std::memory_order_relaxed);
+}
+#endif
+
+void ReHistogram::record(uint32_t micros)
+{
+    size_t index = 0;
+
+    while (index < RE_HISTOGRAM_BUCKETS && micros > bounds[index])
+    {
+        index++;
+    }
+
+    buckets[index].fetch_add(1, std::memory_order_relaxed);
+
+    // Rounded to milliseconds so the sum lasts for weeks in 32 bits, the phases are milliseconds long anyway
+    sumMs.fetch_add((micros + 500) / 1000, std::memory_order_relaxed);
+}
+
+void ReHistogram::print(Print &out, const char *metric, const char *label) const
+{
+    uint32_t cumulative = 0;
+
+    for (size_t b = 0; b < RE_HISTOGRAM_BUCKETS; b++)
+    {
+        cumulative += getBucket(b);
+        out.printf("%s_bucket{%s,le=\"%.3f\"} %lu\n", metric, label, bounds[b] / 1000000.0, cumulative);
+    }
+
+    cumulative += getBucket(RE_HISTOGRAM_BUCKETS);
+    out.printf("%s_bucket{%s,le=\"+Inf\"} %lu\n", metric, label, cumulative);
+    out.printf("%s_sum{%s} %.3f\n", metric, label, getSumMs() / 1000.0);
+    out.printf("%s_count{%s} %lu\n", metric, label, cumulative);
+}
+
+void ReMetrics::print(Print &out) const
+{
+    out.print("# HELP blegateway_latency_seconds Bot command latency per phase\n");
+    out.print("# TYPE blegateway_latency_seconds histogram\n");
+
+    char label[32];
+
+    for (size_t i = 0; i < (size_t)ReLatencyPhase::COUNT; i++)
+    {
+        snprintf(label, sizeof(label), "phase=\"%s\"", phaseName((ReLatencyPhase)i));
+        histograms[i].print(out, "blegateway_latency_seconds", label);
+    }
+
+    out.print("# HELP blegateway_commands_total Bot commands by outcome\n");
+    out.print("# TYPE blegateway_commands_total counter\n");
+
+    for (size_t i = 0; i < (size_t)ReCommandOutcome::COUNT; i++)
+    {
+        out.printf("blegateway_commands_total{outcome=\"%s\"} %lu\n", outcomeName((ReCommandOutcome)i), getCount((ReCommandOutcome)i));
+    }
+
+    out.print("# HELP blegateway_command_retries_total Bot command attempts repeated after a failure\n");
+    out.print("# TYPE blegateway_command_retries_total counter\n");
+    out.printf("blegateway_command_retries_total %lu\n", getRetries());
+
+#ifdef CONFIG_HEAP_USE_HOOKS
+    out.print("# HELP blegateway_heap_allocations_total Heap allocations of all tasks since boot\n");
+    out.print("# TYPE blegateway_heap_allocations_total counter\n");
+    out.printf("blegateway_heap_allocations_total %lu\n", heapAllocations.load(std::memory_order_relaxed));
+#endif
+}
+
+const char *ReMetrics::phaseName(ReLatencyPhase phase)
+{
+    switch (phase)
+    {
+        case ReLatencyPhase::QUEUE_WAIT:        return "queue_wait";
+        case ReLatencyPhase::CONNECT:           return "connect";
+        case ReLatencyPhase::DISCOVERY:         return "discovery";
+        case ReLatencyPhase::SUBSCRIBE:         return "subscribe";
+        case ReLatencyPhase::WRITE:             return "write";
+        case ReLatencyPhase::WRITE_TO_NOTIFY:   return "write_to_notify";
+        case ReLatencyPhase::HTTP:              return "http";
+        case ReLatencyPhase::COMMAND_DIRECT:    return "command_direct";
+        case ReLatencyPhase::COMMAND_GATED:     return "command_gated";
+        default:                                return "unknown";
+    }
+}
+
+const char *ReMetrics::outcomeName(ReCommandOutcome outcome)
+{
+    switch (outcome)
+    {
+        case ReCommandOutcome::DONE:    return "done";
+        case ReCommandOutcome::FAILED:  return "failed";
+        case ReCommandOutcome::EXPIRED: return "expired";
+        default:                        return "unknown";
+    }
+}
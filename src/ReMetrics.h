@@ -0,0 +1,82 @@
+#pragma once
+
+#include <Arduino.h>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+#define RE_HISTOGRAM_BUCKETS 14     // finite buckets, +Inf is added on top
+
+enum class ReLatencyPhase : uint8_t
+{
+    QUEUE_WAIT = 0,     // command enqueued until its session starts: queue, busy Bot, delay and advertisement wait
+    CONNECT,            // connect started until the link is up
+    DISCOVERY,          // service discovery on a GATT cache miss
+    SUBSCRIBE,          // CCCD write until confirmed
+    WRITE,              // command write until confirmed
+    WRITE_TO_NOTIFY,    // command write until the Bot response
+    HTTP,               // HTTP request paused until answered
+    COMMAND_DIRECT,     // command enqueued until done, connecting by address
+    COMMAND_GATED,      // command enqueued until done, connecting after a fresh advertisement
+    COUNT
+};
+
+enum class ReCommandOutcome : uint8_t
+{
+    DONE = 0,
+    FAILED,
+    EXPIRED,            // dropped from the queue before it could run
+    COUNT
+};
+
+/**
+ * Fixed bucket latency histogram, values in microseconds. Buckets are preallocated
+ * atomics so record() and the export never lock, the total count is the sum of
+ * the buckets so a scrape always sees a consistent +Inf bucket.
+ */
+class ReHistogram
+{
+public:
+    void record(uint32_t micros);
+
+    uint32_t getBucket(size_t index) const { return buckets[index].load(std::memory_order_relaxed); }
+    uint32_t getSumMs() const { return sumMs.load(std::memory_order_relaxed); }
+
+    // Prometheus histogram lines of the metric, label is the inner part of the label set, i.e. phase="connect"
+    void print(Print &out, const char *metric, const char *label) const;
+
+    // Upper bounds of the finite buckets in microseconds
+    static const uint32_t bounds[RE_HISTOGRAM_BUCKETS];
+
+private:
+    std::atomic<uint32_t> buckets[RE_HISTOGRAM_BUCKETS + 1] = {};
+    std::atomic<uint32_t> sumMs { 0 };
+};
+
+/**
+ * Command latency per phase and command counters, exported in the Prometheus text format.
+ * Command phases, outcomes and retries are recorded from the BLE worker task, the HTTP phase
+ * from the main loop when the waiter is answered; exported from the AsyncTCP task. Every
+ * counter is an atomic add, so several writer tasks need no lock.
+ */
+class ReMetrics
+{
+public:
+    void record(ReLatencyPhase phase, uint32_t micros) { histograms[(size_t)phase].record(micros); }
+    void count(ReCommandOutcome outcome) { outcomes[(size_t)outcome].fetch_add(1, std::memory_order_relaxed); }
+    void countRetry() { retries.fetch_add(1, std::memory_order_relaxed); }
+
+    const ReHistogram &getHistogram(ReLatencyPhase phase) const { return histograms[(size_t)phase]; }
+    uint32_t getCount(ReCommandOutcome outcome) const { return outcomes[(size_t)outcome].load(std::memory_order_relaxed); }
+    uint32_t getRetries() const { return retries.load(std::memory_order_relaxed); }
+
+    void print(Print &out) const;
+
+    static const char *phaseName(ReLatencyPhase phase);
+    static const char *outcomeName(ReCommandOutcome outcome);
+
+private:
+    ReHistogram histograms[(size_t)ReLatencyPhase::COUNT];
+    std::atomic<uint32_t> outcomes[(size_t)ReCommandOutcome::COUNT] = {};
+    std::atomic<uint32_t> retries { 0 };
+};
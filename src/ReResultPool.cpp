@@ -0,0 +1,88 @@
+#include "ReResultPool.h"
+
+bool ReResultPool::begin()
+{
+    freeList = xQueueCreate(RE_RESULT_POOL_SIZE, sizeof(uint16_t));
+
+    if (!freeList)
+    {
+        return false;
+    }
+
+    for (uint16_t index = 0; index < RE_RESULT_POOL_SIZE; index++)
+    {
+        xQueueSend(freeList, &index, 0);
+    }
+
+    return true;
+}
+
+ReResultHandle ReResultPool::acquire()
+{
+    ReResultHandle handle;
+    uint16_t index;
+
+    if (!freeList || pdPASS != xQueueReceive(freeList, &index, 0))
+    {
+        exhausted.fetch_add(1, std::memory_order_relaxed);
+        return handle;
+    }
+
+    ReResultEvent &record = records[index];
+    record.references.store(1, std::memory_order_relaxed);
+
+    handle.index = index;
+    handle.generation = record.generation.load(std::memory_order_relaxed);
+
+    uint32_t used = inUse.fetch_add(1, std::memory_order_relaxed) + 1;
+
+    if (used > highWater.load(std::memory_order_relaxed))
+    {
+        highWater.store(used, std::memory_order_relaxed);
+    }
+
+    return handle;
+}
+
+ReResultEvent *ReResultPool::get(ReResultHandle handle)
+{
+    if (handle.index >= RE_RESULT_POOL_SIZE)
+    {
+        return nullptr;
+    }
+
+    ReResultEvent &record = records[handle.index];
+
+    if (handle.generation != record.generation.load(std::memory_order_acquire) || 0 == record.references.load(std::memory_order_relaxed))
+    {
+        stale.fetch_add(1, std::memory_order_relaxed);
+        return nullptr;
+    }
+
+    return &record;
+}
+
+void ReResultPool::retain(ReResultHandle handle, uint8_t count)
+{
+    ReResultEvent *record = get(handle);
+
+    if (record)
+    {
+        record->references.fetch_add(count, std::memory_order_relaxed);
+    }
+}
+
+void ReResultPool::release(ReResultHandle handle)
+{
+    ReResultEvent *record = get(handle);
+
+    if (!record || 1 != record->references.fetch_sub(1, std::memory_order_acq_rel))
+    {
+        return;
+    }
+
+    // Last reference, every handle to this record is stale from now on
+    record->generation.fetch_add(1, std::memory_order_release);
+    inUse.fetch_sub(1, std::memory_order_relaxed);
+    xQueueSend(freeList, &handle.index, 0);
+}
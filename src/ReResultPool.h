@@ -0,0 +1,64 @@
+#pragma once
+
+#include <atomic>
+#include <freertos/FreeRTOS.h>
+#include <freertos/queue.h>
+#include "ReBotProtocol.h"
+#include "ReCommandQueue.h"
+
+#define RE_RESULT_POOL_SIZE 46
+
+// Command result record, shared by everything which still has to act on the result
+struct ReResultEvent
+{
+    ReCommand command;
+    ReBotResult result;
+    char text[RE_RESULT_TEXT_LENGTH];   // ReBotProtocol::toText() of the result
+    uint32_t publishedAt = 0;           // micros()
+
+    std::atomic<uint8_t> references { 0 };
+    std::atomic<uint16_t> generation { 0 };    // bumped when the record goes back to the pool
+};
+
+// Reference to a pooled record, goes stale when the record is reused
+struct ReResultHandle
+{
+    uint16_t index = UINT16_MAX;
+    uint16_t generation = 0;
+
+    bool isValid() const { return UINT16_MAX != index; }
+};
+
+/**
+ * Fixed capacity pool of result records in static storage, nothing is allocated per command.
+ * Deferred work keeps a handle, never a pointer: get() of a handle whose record has been
+ * released and reused returns nullptr instead of somebody else's result. A record is back in
+ * the pool when its last reference is released. Safe to use from any task.
+ */
+class ReResultPool
+{
+public:
+    bool begin();
+
+    // Free record with one reference for the caller, invalid handle when the pool is empty
+    ReResultHandle acquire();
+    // Record of a live handle, nullptr for a stale or invalid one
+    ReResultEvent *get(ReResultHandle handle);
+    void retain(ReResultHandle handle, uint8_t count = 1);
+    void release(ReResultHandle handle);
+
+    size_t capacity() const { return RE_RESULT_POOL_SIZE; }
+    uint32_t getInUse() const { return inUse.load(std::memory_order_relaxed); }
+    uint32_t getHighWater() const { return highWater.load(std::memory_order_relaxed); }
+    uint32_t getExhausted() const { return exhausted.load(std::memory_order_relaxed); }
+    uint32_t getStale() const { return stale.load(std::memory_order_relaxed); }
+
+private:
+    ReResultEvent records[RE_RESULT_POOL_SIZE];
+    QueueHandle_t freeList = nullptr;   // indexes of the free records
+
+    std::atomic<uint32_t> inUse { 0 };
+    std::atomic<uint32_t> highWater { 0 };
+    std::atomic<uint32_t> exhausted { 0 };
+    std::atomic<uint32_t> stale { 0 };
+};
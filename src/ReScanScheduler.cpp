@@ -0,0 +1,207 @@
+#include "ReScanScheduler.h"
+#include "ReCommon.h"
+
+static const ReScanParams scanParams[] = {
+    { 100, 50, true },      // AGGRESSIVE, 50 %, leaves Wi-Fi half of the radio time
+    { 1280, 60, true },     // LOW_DUTY, ~5 %
+    { 1280, 60, false },    // PASSIVE, ~5 % and no scan requests
+};
+
+static_assert(sizeof(scanParams) / sizeof(scanParams[0]) == (size_t)ReScanMode::COUNT, "scanParams must list every ReScanMode");
+
+void ReScanScheduler::begin(NimBLEScan *scan, uint32_t scanTimeMs, bool useWhitelist)
+{
+    this->scan = scan;
+    this->useWhitelist = useWhitelist;
+    scanTime = scanTimeMs;
+    modeSince = filterSince = millis();
+
+    apply(ReScanMode::AGGRESSIVE, millis());
+}
+
+bool ReScanScheduler::loop(uint32_t now, ReBotRegistry &registry, bool commandPending, bool busy)
+{
+    bool changed = false;
+    ReScanMode wanted = ReScanMode::AGGRESSIVE;
+
+    // The whitelist can not be changed while the controller scans or connects with it
+    if (useWhitelist && !busy && whitelistGeneration != registry.getGeneration())
+    {
+        rebuildWhitelist(registry, now);
+    }
+
+    bool allPresent = registry.allPresent(now);
+
+    if (!allPresent && !absent)
+    {
+        absentSince = now;
+    }
+
+    absent = !allPresent;
+
+    if (commandPending)
+    {
+        wanted = ReScanMode::AGGRESSIVE;
+    }
+    else if (allPresent)
+    {
+        wanted = (passiveEnough && !activeOnly) ? ReScanMode::PASSIVE : ReScanMode::LOW_DUTY;
+    }
+    else if ((now - absentSince) >= RE_SCAN_ABSENT_AGGRESSIVE_MS)
+    {
+        // Missing for too long, likely a dead battery, keep looking at the low duty cycle
+        wanted = ReScanMode::LOW_DUTY;
+    }
+
+    if (wanted != mode)
+    {
+        logger.info(RE_TAG, "Scan mode %s -> %s", modeName(mode), modeName(wanted));
+        apply(wanted, now);
+        changed = true;
+    }
+
+    // Scan is restarted when its time is up, or after a connection has stopped it
+    if (!busy && !scan->isScanning())
+    {
+        scan->start(scanTime, false, false);
+    }
+
+    return changed;
+}
+
+void ReScanScheduler::onBotAdvertisement(bool hasServiceData, uint32_t now)
+{
+    if (ReScanMode::PASSIVE == mode && !hasServiceData && passiveEnough)
+    {
+        // Service data comes in the scan response only, passive scanning can not see the battery
+        passiveEnough = false;
+    }
+
+    if (awaitingFirstAdv)
+    {
+        awaitingFirstAdv = false;
+
+        ReScanModeStats &modeStats = stats[(size_t)mode];
+        uint32_t elapsed = now - modeSince;
+
+        modeStats.firstAdvLast = elapsed;
+        modeStats.firstAdvAvg = modeStats.firstAdvCount ? (modeStats.firstAdvAvg * 7 + elapsed) / 8 : elapsed;
+        modeStats.firstAdvCount++;
+    }
+}
+
+uint32_t ReScanScheduler::getTimeInMode(ReScanMode mode, uint32_t now) const
+{
+    uint32_t time = stats[(size_t)mode].timeMs;
+
+    return (mode == this->mode) ? time + (now - modeSince) : time;
+}
+
+const char *ReScanScheduler::filterName(ReScanFilter filter)
+{
+    switch (filter)
+    {
+    case ReScanFilter::HOST:
+        return "host";
+    case ReScanFilter::CONTROLLER:
+        return "controller";
+    default:
+        return "unknown";
+    }
+}
+
+uint32_t ReScanScheduler::getTimeInFilter(ReScanFilter filter, uint32_t now) const
+{
+    uint32_t time = filterTimeMs[(size_t)filter];
+
+    return (filter == this->filter) ? time + (now - filterSince) : time;
+}
+
+uint32_t ReScanScheduler::getDutyCycle(ReScanMode mode)
+{
+    const ReScanParams &params = scanParams[(size_t)mode];
+
+    return (uint32_t)params.window * 1000 / params.interval;
+}
+
+uint32_t ReScanScheduler::getAverageDutyCycle(uint32_t now) const
+{
+    uint64_t weighted = 0;
+    uint64_t total = 0;
+
+    for (size_t i = 0; i < (size_t)ReScanMode::COUNT; i++)
+    {
+        uint32_t time = getTimeInMode((ReScanMode)i, now);
+
+        weighted += (uint64_t)time * getDutyCycle((ReScanMode)i);
+        total += time;
+    }
+
+    return total ? (uint32_t)(weighted / total) : 0;
+}
+
+const char *ReScanScheduler::modeName(ReScanMode mode)
+{
+    switch (mode)
+    {
+        case ReScanMode::AGGRESSIVE:    return "aggressive";
+        case ReScanMode::LOW_DUTY:      return "low_duty";
+        case ReScanMode::PASSIVE:       return "passive";
+        default:                        return "unknown";
+    }
+}
+
+void ReScanScheduler::apply(ReScanMode newMode, uint32_t now)
+{
+    // Parameters only take effect with a new scan
+    if (scan->isScanning())
+    {
+        scan->stop();
+    }
+
+    stats[(size_t)mode].timeMs += now - modeSince;
+
+    const ReScanParams &params = scanParams[(size_t)newMode];
+
+    /** Set scan interval (how often) and window (how long) in milliseconds */
+    scan->setInterval(params.interval);
+    scan->setWindow(params.window);
+
+    /** Active scan gathers the scan response with the service data, but uses more energy from both devices */
+    scan->setActiveScan(params.active);
+
+    mode = newMode;
+    modeSince = now;
+    awaitingFirstAdv = true;
+    stats[(size_t)mode].enters++;
+}
+
+void ReScanScheduler::rebuildWhitelist(ReBotRegistry &registry, uint32_t now)
+{
+    if (scan->isScanning())
+    {
+        scan->stop();
+    }
+
+    while (NimBLEDevice::getWhiteListCount() > 0)
+    {
+        NimBLEDevice::whiteListRemove(NimBLEDevice::getWhiteListAddress(0));
+    }
+
+    bool complete = registry.size() > 0;
+
+    for (ReBot &bot : registry)
+    {
+        complete &= NimBLEDevice::whiteListAdd(NimBLEAddress(bot.address, bot.addressType));
+    }
+
+    filterTimeMs[(size_t)filter] += now - filterSince;
+    filterSince = now;
+
+    // Fall back to the host filter when the controller could not take all the Bots
+    filter = complete ? ReScanFilter::CONTROLLER : ReScanFilter::HOST;
+    scan->setFilterPolicy(complete ? BLE_HCI_SCAN_FILT_USE_WL : BLE_HCI_SCAN_FILT_NO_WL);
+    whitelistGeneration = registry.getGeneration();
+
+    logger.info(RE_TAG, "Scan whitelist rebuilt with %d Bot(s), controller filter: %s", NimBLEDevice::getWhiteListCount(), complete ? "ON" : "OFF");
+}
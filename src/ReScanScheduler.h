@@ -0,0 +1,98 @@
+#pragma once
+
+#include <NimBLEDevice.h>
+#include "ReBotRegistry.h"
+
+#define RE_SCAN_ABSENT_AGGRESSIVE_MS 60000  // longest aggressive scan for a missing Bot alone, a dead one must not hold it forever
+
+enum class ReScanMode : uint8_t
+{
+    AGGRESSIVE = 0,     // command pending or a Bot went missing recently, scan half of the time
+    LOW_DUTY,           // all Bots present, short active windows
+    PASSIVE,            // all Bots present and their advertisements carry the service data, no scan requests
+    COUNT
+};
+
+// Scan interval and window in milliseconds
+struct ReScanParams
+{
+    uint16_t interval;
+    uint16_t window;
+    bool active;
+};
+
+struct ReScanModeStats
+{
+    uint32_t enters = 0;
+    uint32_t timeMs = 0;                // total time spent in the mode
+    uint32_t firstAdvLast = 0;          // time to the first Bot advertisement after entering the mode, ms
+    uint32_t firstAdvAvg = 0;           // smoothed, ms
+    uint32_t firstAdvCount = 0;
+};
+
+enum class ReScanFilter : uint8_t
+{
+    HOST = 0,           // every advertiser reaches the host, matched in ReScanCallbacks
+    CONTROLLER,         // controller drops advertisers which are not on the whitelist
+    COUNT
+};
+
+/**
+ * Chooses the scan duty cycle from the state of the Bots and the command queue.
+ * Scanning takes radio time from Wi-Fi, so the aggressive duty cycle is used only while
+ * a command waits or for RE_SCAN_ABSENT_AGGRESSIVE_MS after a Bot went missing; a Bot
+ * which stays missing is then looked for with the low duty cycle.
+ * Optionally the controller filters advertisements against a whitelist of the
+ * registered Bots, rebuilt whenever the registry generation changes.
+ */
+class ReScanScheduler
+{
+public:
+    void begin(NimBLEScan *scan, uint32_t scanTimeMs, bool useWhitelist);
+    // Never drop to passive scanning, i.e. the sensors send their data in the scan responses
+    void setActiveOnly(bool activeOnly) { this->activeOnly = activeOnly; }
+
+    // BLE worker task, busy is set while a Bot command owns the radio; true when the mode has changed
+    bool loop(uint32_t now, ReBotRegistry &registry, bool commandPending, bool busy);
+
+    // NimBLE host task, for every advertisement of a registered Bot
+    void onBotAdvertisement(bool hasServiceData, uint32_t now);
+
+    ReScanMode getMode() const { return mode; }
+    const ReScanModeStats &getStats(ReScanMode mode) const { return stats[(size_t)mode]; }
+    uint32_t getTimeInMode(ReScanMode mode, uint32_t now) const;
+    bool isPassiveEnough() const { return passiveEnough; }
+
+    ReScanFilter getFilter() const { return filter; }
+    static const char *filterName(ReScanFilter filter);
+    uint32_t getTimeInFilter(ReScanFilter filter, uint32_t now) const;
+
+    // Duty cycle in per mille, of the mode and averaged over the uptime
+    static uint32_t getDutyCycle(ReScanMode mode);
+    uint32_t getAverageDutyCycle(uint32_t now) const;
+
+    static const char *modeName(ReScanMode mode);
+
+private:
+    void apply(ReScanMode newMode, uint32_t now);
+    void rebuildWhitelist(ReBotRegistry &registry, uint32_t now);
+
+    NimBLEScan *scan = nullptr;
+    uint32_t scanTime = 0;
+
+    ReScanMode mode = ReScanMode::AGGRESSIVE;
+    uint32_t modeSince = 0;
+    bool absent = false;                    // a Bot is not present, since absentSince
+    uint32_t absentSince = 0;
+    volatile bool awaitingFirstAdv = false;
+    volatile bool passiveEnough = true;     // cleared by the first Bot advertisement without service data in passive mode
+
+    ReScanModeStats stats[(size_t)ReScanMode::COUNT];
+
+    bool useWhitelist = false;
+    bool activeOnly = false;
+    uint32_t whitelistGeneration = 0;
+    ReScanFilter filter = ReScanFilter::HOST;
+    uint32_t filterSince = 0;
+    uint32_t filterTimeMs[(size_t)ReScanFilter::COUNT] = {};
+};
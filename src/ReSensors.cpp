@@ -0,0 +1,254 @@
+#include "ReSensors.h"
+#include "ReBotRegistry.h"
+#include <algorithm>
+
+typedef bool (*ReSensorDecode)(const uint8_t *data, size_t length, const uint8_t *manufacturer, size_t manufacturerLength, ReSensorReading &reading);
+
+// Service data layouts as in the Switchbot BLE API, byte 0 is the device type, byte 2 the battery
+static bool decodeMeter(const uint8_t *data, size_t length, const uint8_t *manufacturer, size_t manufacturerLength, ReSensorReading &reading)
+{
+    // Meter and Meter Plus: bytes 3-5 of the service data; the Outdoor Meter has only 3 bytes of
+    // service data and the same 3 bytes at 8-10 of the manufacturer data
+    const uint8_t *values;
+
+    if (length >= 6)
+    {
+        values = data + 3;
+    }
+    else if (manufacturerLength >= 11)
+    {
+        values = manufacturer + 8;
+    }
+    else
+    {
+        return false;
+    }
+
+    int16_t tenths = (values[1] & 0x7F) * 10 + (values[0] & 0x0F);
+
+    reading.temperature = (values[1] & 0x80) ? tenths : -tenths;
+    reading.humidity = values[2] & 0x7F;
+    reading.fahrenheit = values[2] & 0x80;
+    return true;
+}
+
+static bool decodeContact(const uint8_t *data, size_t length, const uint8_t *, size_t, ReSensorReading &reading)
+{
+    if (length < 9)
+    {
+        return false;
+    }
+
+    reading.motion = data[1] & 0x40;
+    reading.light = data[3] & 0x01;
+    reading.open = data[3] & 0x02;
+    reading.openTimeout = (data[3] & 0x06) == 0x06;
+    reading.buttonCount = data[8] & 0x0F;
+    return true;
+}
+
+static bool decodeMotion(const uint8_t *data, size_t length, const uint8_t *, size_t, ReSensorReading &reading)
+{
+    if (length < 6)
+    {
+        return false;
+    }
+
+    reading.motion = data[1] & 0x40;
+    reading.light = data[5] & 0x02;
+    return true;
+}
+
+static bool decodeCurtain(const uint8_t *data, size_t length, const uint8_t *, size_t, ReSensorReading &reading)
+{
+    if (length < 5)
+    {
+        return false;
+    }
+
+    reading.calibrated = data[1] & 0x40;
+    reading.moving = data[3] & 0x80;
+    reading.position = std::min<uint8_t>(data[3] & 0x7F, 100);
+    reading.lightLevel = (data[4] >> 4) & 0x0F;
+    return true;
+}
+
+struct ReSensorDecoder
+{
+    ReSensorType type;
+    ReSensorDecode decode;
+};
+
+static constexpr ReSensorDecoder sensorDecoders[] = {
+    { ReSensorType::NONE, nullptr },
+    { ReSensorType::METER, decodeMeter },
+    { ReSensorType::CONTACT, decodeContact },
+    { ReSensorType::MOTION, decodeMotion },
+    { ReSensorType::CURTAIN, decodeCurtain },
+};
+
+static_assert(sizeof(sensorDecoders) / sizeof(sensorDecoders[0]) == (size_t)ReSensorType::COUNT, "sensorDecoders must list every ReSensorType");
+
+// Sensor type of every device type byte (7 bits), one lookup per advertisement
+struct ReSensorTypeTable
+{
+    ReSensorType type[128];
+
+    constexpr ReSensorTypeTable() : type()
+    {
+        type['T'] = ReSensorType::METER;        // Meter
+        type['i'] = ReSensorType::METER;        // Meter Plus
+        type['w'] = ReSensorType::METER;        // Outdoor Meter
+        type['d'] = ReSensorType::CONTACT;
+        type['s'] = ReSensorType::MOTION;
+        type['c'] = ReSensorType::CURTAIN;
+    }
+};
+
+static constexpr ReSensorTypeTable sensorTypes;
+
+bool ReSensorReading::sameState(const ReSensorReading &other) const
+{
+    return type == other.type && temperature == other.temperature && humidity == other.humidity &&
+           motion == other.motion && light == other.light && open == other.open && openTimeout == other.openTimeout &&
+           buttonCount == other.buttonCount && position == other.position && moving == other.moving;
+}
+
+bool ReSensorStore::ingest(uint64_t address, const uint8_t *serviceData, size_t length, const uint8_t *manufacturerData, size_t manufacturerLength,
+                           int8_t rssi, uint32_t now)
+{
+    stats.advertisements++;
+
+    if (length < 3)
+    {
+        stats.unknown++;
+        return false;
+    }
+
+    ReSensorType type = sensorTypes.type[serviceData[0] & 0x7F];
+    ReSensorReading reading;
+
+    if (ReSensorType::NONE == type || !sensorDecoders[(size_t)type].decode(serviceData, length, manufacturerData, manufacturerLength, reading))
+    {
+        stats.unknown++;
+        return false;
+    }
+
+    reading.type = type;
+    reading.model = serviceData[0] & 0x7F;
+    reading.battery = serviceData[2] & 0x7F;
+    reading.rssi = rssi;
+
+    Slot *slot = findSlot(address);
+    ReSensorSnapshot &snapshot = slot->beginWrite();
+
+    if (snapshot.address != address)
+    {
+        snapshot.address = address;
+        snapshot.updates = 0;
+    }
+
+    snapshot.lastSeen = now;
+    snapshot.updates++;
+    snapshot.reading = reading;
+
+    slot->endWrite();
+
+    stats.decoded++;
+    return true;
+}
+
+ReSensorStore::Slot *ReSensorStore::findSlot(uint64_t address)
+{
+    Slot *oldest = &slots[0];
+
+    for (Slot &slot : slots)
+    {
+        if (slot.peek().address == address)
+        {
+            return &slot;
+        }
+
+        if (0 == slot.peek().address)
+        {
+            return &slot;
+        }
+
+        if ((int32_t)(slot.peek().lastSeen - oldest->peek().lastSeen) < 0)
+        {
+            oldest = &slot;
+        }
+    }
+
+    stats.replaced++;
+    return oldest;
+}
+
+bool ReSensorStore::read(size_t index, ReSensorSnapshot &snapshot) const
+{
+    if (index >= RE_MAX_SENSORS)
+    {
+        return false;
+    }
+
+    slots[index].read(snapshot);
+
+    return 0 != snapshot.address;
+}
+
+void ReSensorStore::toJson(const ReSensorSnapshot &snapshot, uint32_t now, JsonObject doc)
+{
+    const ReSensorReading &reading = snapshot.reading;
+    char mac[18];
+
+    ReBotRegistry::formatAddress(snapshot.address, mac);
+
+    char model[2] = { (char)reading.model, 0 };
+
+    doc["mac"] = mac;
+    doc["type"] = typeName(reading.type);
+    doc["model"] = model;
+    doc["battery"] = reading.battery;
+    doc["rssi"] = reading.rssi;
+    doc["age_ms"] = now - snapshot.lastSeen;
+
+    switch (reading.type)
+    {
+        case ReSensorType::METER:
+            doc["temperature"] = reading.temperature / 10.0f;
+            doc["humidity"] = reading.humidity;
+            doc["fahrenheit"] = reading.fahrenheit;
+            break;
+        case ReSensorType::CONTACT:
+            doc["open"] = reading.open;
+            doc["open_timeout"] = reading.openTimeout;
+            doc["motion"] = reading.motion;
+            doc["light"] = reading.light;
+            doc["button_count"] = reading.buttonCount;
+            break;
+        case ReSensorType::MOTION:
+            doc["motion"] = reading.motion;
+            doc["light"] = reading.light;
+            break;
+        case ReSensorType::CURTAIN:
+            doc["position"] = reading.position;
+            doc["moving"] = reading.moving;
+            doc["calibrated"] = reading.calibrated;
+            doc["light_level"] = reading.lightLevel;
+            break;
+        default:
+            break;
+    }
+}
+
+const char *ReSensorStore::typeName(ReSensorType type)
+{
+    switch (type)
+    {
+        case ReSensorType::METER:   return "meter";
+        case ReSensorType::CONTACT: return "contact";
+        case ReSensorType::MOTION:  return "motion";
+        case ReSensorType::CURTAIN: return "curtain";
+        default:                    return "none";
+    }
+}
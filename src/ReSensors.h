@@ -0,0 +1,95 @@
+#pragma once
+
+#include <ArduinoJson.h>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include "ReSeqSlot.h"
+
+#define RE_MAX_SENSORS 16           // latest readings kept, the oldest sensor is replaced when full
+
+enum class ReSensorType : uint8_t
+{
+    NONE = 0,
+    METER,              // Meter, Meter Plus and Outdoor Meter
+    CONTACT,
+    MOTION,
+    CURTAIN,
+    COUNT
+};
+
+// Latest decoded state of one sensor, only the fields of its type are set
+struct ReSensorReading
+{
+    ReSensorType type = ReSensorType::NONE;
+    uint8_t model = 0;                  // device type byte of the service data
+    uint8_t battery = 0;
+    int8_t rssi = 0;
+
+    int16_t temperature = 0;            // Meter, tenths of degree Celsius
+    uint8_t humidity = 0;               // Meter, %
+    bool fahrenheit = false;            // Meter, display unit
+
+    bool motion = false;                // Contact and Motion
+    bool light = false;                 // Contact and Motion, ambient light detected
+    bool open = false;                  // Contact
+    bool openTimeout = false;           // Contact, left open
+    uint8_t buttonCount = 0;            // Contact, wraps at 16
+
+    uint8_t position = 0;               // Curtain, % open
+    uint8_t lightLevel = 0;             // Curtain
+    bool moving = false;                // Curtain
+    bool calibrated = false;            // Curtain
+
+    // Same sensor state, RSSI and battery noise aside
+    bool sameState(const ReSensorReading &other) const;
+};
+
+// Consistent copy of one slot of the store
+struct ReSensorSnapshot
+{
+    uint64_t address = 0;
+    uint32_t lastSeen = 0;
+    uint32_t updates = 0;               // changes whenever a new advertisement was decoded
+    ReSensorReading reading;
+};
+
+struct ReSensorStats
+{
+    uint32_t advertisements = 0;        // Switchbot service data from addresses which are not our Bots
+    uint32_t decoded = 0;
+    uint32_t unknown = 0;               // device type without a decoder, or too short
+    uint32_t replaced = 0;              // sensors dropped from the full store
+};
+
+/**
+ * Fixed size latest-value store of the Switchbot sensors heard by the scanner.
+ * Written only by the NimBLE host task from the scan callback, decoders are picked
+ * by the device type byte through a table and nothing is allocated per advertisement.
+ * Every slot is a ReSeqSlot, readers (the web server, the MQTT task) retry when they
+ * overlap a write instead of taking a lock.
+ */
+class ReSensorStore
+{
+public:
+    // Decode the service and manufacturer data of an advertisement, false when it is not a known sensor
+    bool ingest(uint64_t address, const uint8_t *serviceData, size_t length, const uint8_t *manufacturerData, size_t manufacturerLength,
+                int8_t rssi, uint32_t now);
+
+    // Copy of the slot, false when the slot is empty
+    bool read(size_t slot, ReSensorSnapshot &snapshot) const;
+    size_t capacity() const { return RE_MAX_SENSORS; }
+
+    const ReSensorStats &getStats() const { return stats; }
+
+    static void toJson(const ReSensorSnapshot &snapshot, uint32_t now, JsonObject doc);
+    static const char *typeName(ReSensorType type);
+
+private:
+    typedef ReSeqSlot<ReSensorSnapshot> Slot;
+
+    Slot *findSlot(uint64_t address);
+
+    Slot slots[RE_MAX_SENSORS];
+    ReSensorStats stats;
+};
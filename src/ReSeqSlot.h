@@ -0,0 +1,57 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <type_traits>
+
+/**
+ * Value with one writer task and any number of readers, guarded by a sequence counter.
+ * The writer never waits, the counter is odd while a write is in progress and a reader
+ * which overlapped a write copies the value again, so it gets either the old or the new
+ * value as a whole.
+ */
+template <typename T>
+class ReSeqSlot
+{
+    static_assert(std::is_trivially_copyable<T>::value, "ReSeqSlot value must be trivially copyable");
+
+public:
+    // Writer only: change the value in place between beginWrite() and endWrite()
+    T &beginWrite()
+    {
+        sequence.store(sequence.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        return value;
+    }
+
+    void endWrite() { sequence.store(sequence.load(std::memory_order_relaxed) + 1, std::memory_order_release); }
+
+    void write(const T &newValue)
+    {
+        beginWrite() = newValue;
+        endWrite();
+    }
+
+    // Writer only, its own value needs no copy
+    const T &peek() const { return value; }
+
+    // Any task
+    void read(T &copy) const
+    {
+        uint32_t before;
+        uint32_t after;
+
+        do
+        {
+            before = sequence.load(std::memory_order_acquire);
+            copy = value;
+            std::atomic_thread_fence(std::memory_order_acquire);
+            after = sequence.load(std::memory_order_relaxed);
+        }
+        while ((before & 1) || before != after);
+    }
+
+private:
+    std::atomic<uint32_t> sequence { 0 };
+    T value {};
+};
@@ -1,6 +1,11 @@
 #include "ReServer.h"
+#include "ReBLEDevice.h"
+#include "ReBLEWorker.h"
+#include "ReLoopProfiler.h"
+#include "ReBLEUtils.h"
 #include "ReContext.h"
 #include "ReCommon.h"
+#include <NimBLEDevice.h>
 #include <MycilaSystem.h>
 #include <Matter.h>
 
@@ -13,24 +18,211 @@ void ReServer::setESPConnect(Mycila::ESPConnect *esp)
     espConnect = esp;
 }
 
-void ReServer::pressRequestNotifyJson(const std::string &resultData)
+void ReServer::setBLEDevice(const ReBLEDevice *device)
 {
-    if (auto request = pressRequest.lock())
+    bleDevice = device;
+}
+
+void ReServer::setBLEWorker(const ReBLEWorker *worker)
+{
+    bleWorker = worker;
+}
+
+void ReServer::setLoopProfiler(const ReLoopProfiler *profiler)
+{
+    loopProfiler = profiler;
+}
+
+void ReServer::pressRequestNotifyJson(uint32_t correlationId, uint8_t botId, const ReBotResult &result)
+{
+    AsyncWebServerRequestPtr done[RE_MAX_WAITERS];
+    uint32_t pausedAt[RE_MAX_WAITERS];
+    size_t count = 0;
+    ReBatchWaiter batchDone;
+
+    {
+        std::lock_guard<std::mutex> lock(waitersLock);
+
+        for (ReWaiter &waiter : waiters)
+        {
+            if (0 != correlationId && waiter.correlationId == correlationId)
+            {
+                pausedAt[count] = waiter.pausedAt;
+                done[count++] = std::move(waiter.request);
+                waiter.correlationId = 0;
+            }
+        }
+
+        for (ReBatchWaiter &batch : batches)
+        {
+            for (size_t i = 0; 0 != correlationId && i < batch.count; i++)
+            {
+                if (batch.correlationIds[i] != correlationId)
+                {
+                    continue;
+                }
+
+                batch.results[i] = result;
+                batch.correlationIds[i] = 0;
+
+                // Last result of the batch, answer it outside of the lock
+                if (0 == --batch.pending)
+                {
+                    batchDone = batch;
+                    batchDone.request = std::move(batch.request);
+                    batch.count = 0;
+                }
+            }
+        }
+    }
+
+    if (batchDone.count)
+    {
+        if (auto request = batchDone.request.lock())
+        {
+            sendBatchJson(request.get(), 200, batchDone);
+            ctx.getMetrics().record(ReLatencyPhase::HTTP, micros() - batchDone.pausedAt);
+        }
+    }
+
+    for (size_t i = 0; i < count; i++)
+    {
+        if (auto request = done[i].lock())
+        {
+            sendResultJson(request.get(), 200, botId, result);
+            ctx.getMetrics().record(ReLatencyPhase::HTTP, micros() - pausedAt[i]);
+        }
+    }
+}
+
+void ReServer::loop()
+{
+    AsyncWebServerRequestPtr expired[RE_MAX_WAITERS];
+    uint8_t botIds[RE_MAX_WAITERS];
+    uint32_t pausedAt[RE_MAX_WAITERS];
+    size_t count = 0;
+    ReBatchWaiter expiredBatches[RE_MAX_BATCHES];
+    size_t batchCount = 0;
+    uint32_t now = millis();
+    ReBotResult result = ReBotResult::failure("Timeout waiting for Switchbot");
+
+    {
+        std::lock_guard<std::mutex> lock(waitersLock);
+
+        for (ReWaiter &waiter : waiters)
+        {
+            if (0 != waiter.correlationId && (int32_t)(now - waiter.deadline) > 0)
+            {
+                logger.warn(RE_TAG, "Command %ld for Bot %d: no result in time, answering with timeout", waiter.correlationId, waiter.botId);
+
+                botIds[count] = waiter.botId;
+                pausedAt[count] = waiter.pausedAt;
+                expired[count++] = std::move(waiter.request);
+                waiter.correlationId = 0;
+            }
+        }
+
+        // Batches are answered with the results which came in time
+        for (ReBatchWaiter &batch : batches)
+        {
+            if (0 == batch.count || (int32_t)(now - batch.deadline) <= 0)
+            {
+                continue;
+            }
+
+            logger.warn(RE_TAG, "Batch of %d commands: %d results missing, answering with timeout", batch.count, batch.pending);
+
+            for (size_t i = 0; i < batch.count; i++)
+            {
+                if (0 != batch.correlationIds[i])
+                {
+                    batch.results[i] = result;
+                }
+            }
+
+            expiredBatches[batchCount] = batch;
+            expiredBatches[batchCount++].request = std::move(batch.request);
+            batch.count = 0;
+        }
+    }
+
+    for (size_t i = 0; i < count; i++)
+    {
+        if (auto request = expired[i].lock())
+        {
+            sendResultJson(request.get(), 504, botIds[i], result);
+            ctx.getMetrics().record(ReLatencyPhase::HTTP, micros() - pausedAt[i]);
+        }
+    }
+
+    for (size_t i = 0; i < batchCount; i++)
+    {
+        if (auto request = expiredBatches[i].request.lock())
+        {
+            sendBatchJson(request.get(), 504, expiredBatches[i]);
+            ctx.getMetrics().record(ReLatencyPhase::HTTP, micros() - expiredBatches[i].pausedAt);
+        }
+    }
+
+    stream.loop();
+}
+
+// Result replies are sent from the main loop, formatted on the stack instead of through a JsonDocument
+void ReServer::sendResultJson(AsyncWebServerRequest *request, int code, uint8_t botId, const ReBotResult &result)
+{
+    char output[RE_RESULT_JSON_LENGTH];
+
+    if (0 == ReBotProtocol::toJson(botId, result, output, sizeof(output)))
+    {
+        request->send(500, "text/plain", "Result too long");
+        return;
+    }
+
+    request->send(code, "application/json", output);
+}
+
+void ReServer::sendBatchJson(AsyncWebServerRequest *request, int code, const ReBatchWaiter &batch)
+{
+    AsyncResponseStream *response = request->beginResponseStream("application/json", RE_BATCH_MAX_COMMANDS * RE_RESULT_JSON_LENGTH);
+    response->setCode(code);
+    response->print("{\"results\":[");
+
+    // Same order as the commands in the request
+    for (size_t i = 0; i < batch.count; i++)
     {
-        JsonDocument doc;
-        doc["status"] = resultData.substr(0, 2);
-        doc["payload"] = resultData.substr(2);
+        char item[RE_RESULT_JSON_LENGTH];
+
+        if (ReBotProtocol::toJson(batch.botIds[i], batch.results[i], item, sizeof(item)))
+        {
+            response->print(i ? "," : "");
+            response->print(item);
+        }
+    }
+
+    response->print("]}");
+    request->send(response);
+}
 
-        String output;
-        serializeJson(doc, output);
-        request->send(200, "application/json", output);
+// Serialize straight into the response buffer, sized up front so it never grows
+void ReServer::sendJson(AsyncWebServerRequest *request, int code, const JsonDocument &doc)
+{
+    if (doc.overflowed())
+    {
+        request->send(500, "text/plain", "Response too large");
+        return;
     }
+
+    AsyncResponseStream *response = request->beginResponseStream("application/json", measureJson(doc));
+    response->setCode(code);
+    serializeJson(doc, *response);
+    request->send(response);
 }
 
 void ReServer::begin()
 {
     setAuthenticationMiddleware();
     setHandlers();
+    stream.begin(*this);
     AsyncWebServer::begin();
 }
 
@@ -55,6 +247,8 @@ void ReServer::setHandlers()
     onNotFound(std::bind(&ReServer::handleNotFound, this, std::placeholders::_1));
 
     on("/heap", HTTP_GET, (ArRequestHandlerFunction)std::bind(&ReServer::heapHandler, this, std::placeholders::_1));
+    on("/tasks", HTTP_GET, (ArRequestHandlerFunction)std::bind(&ReServer::tasksHandler, this, std::placeholders::_1));
+    on("/loop", HTTP_GET, (ArRequestHandlerFunction)std::bind(&ReServer::loopHandler, this, std::placeholders::_1));
     on("/admin/info", HTTP_GET, (ArRequestHandlerFunction)std::bind(&ReServer::wifiInfoHandler, this, std::placeholders::_1))
         .addMiddleware(&basicAuth);
 
@@ -82,6 +276,20 @@ void ReServer::setHandlers()
     on("/switchbot/press", HTTP_GET | HTTP_POST, (ArRequestHandlerFunction)std::bind(&ReServer::switchbotPressHandler, this, std::placeholders::_1));
 
     on("/switchbot/command", HTTP_GET | HTTP_POST, (ArRequestHandlerFunction)std::bind(&ReServer::switchbotCommandHandler, this, std::placeholders::_1));
+
+    on(AsyncURIMatcher::exact("/switchbot/batch"), HTTP_POST, std::bind(&ReServer::switchbotBatchHandler, this, std::placeholders::_1, std::placeholders::_2));
+
+    on("/switchbot/bots", HTTP_GET, (ArRequestHandlerFunction)std::bind(&ReServer::switchbotBotsHandler, this, std::placeholders::_1));
+
+    on("/switchbot/queue", HTTP_GET, (ArRequestHandlerFunction)std::bind(&ReServer::switchbotQueueHandler, this, std::placeholders::_1));
+
+    on("/switchbot/sessions", HTTP_GET, (ArRequestHandlerFunction)std::bind(&ReServer::switchbotSessionsHandler, this, std::placeholders::_1));
+
+    on("/switchbot/scan", HTTP_GET, (ArRequestHandlerFunction)std::bind(&ReServer::switchbotScanHandler, this, std::placeholders::_1));
+
+    on("/switchbot/sensors", HTTP_GET, (ArRequestHandlerFunction)std::bind(&ReServer::switchbotSensorsHandler, this, std::placeholders::_1));
+
+    on("/metrics", HTTP_GET, (ArRequestHandlerFunction)std::bind(&ReServer::metricsHandler, this, std::placeholders::_1));
 }
 
 void ReServer::handleRoot(AsyncWebServerRequest *request)
@@ -91,32 +299,95 @@ void ReServer::handleRoot(AsyncWebServerRequest *request)
 
 void ReServer::handleNotFound(AsyncWebServerRequest *request)
 {
-    String message = "Invalid Url\n\n";
-    message += "URI: ";
-    message += request->url();
-    message += "\nMethod: ";
-    message += (request->method() == HTTP_GET) ? "GET" : "POST";
-    message += "\nArguments: ";
-    message += request->args();
-    message += "\n";
+    AsyncResponseStream *response = request->beginResponseStream("text/plain", 256);
+    response->setCode(404);
+    response->printf("Invalid Url\n\nURI: %s\nMethod: %s\nArguments: %u\n",
+                     request->url().c_str(), (request->method() == HTTP_GET) ? "GET" : "POST", request->args());
+
     for (uint8_t i = 0; i < request->args(); i++)
     {
-        message += " " + request->argName(i) + ": " + request->arg(i) + "\n";
+        response->printf(" %s: %s\n", request->argName(i).c_str(), request->arg(i).c_str());
     }
-    request->send(404, "text/plain", message);
+
+    request->send(response);
 }
 
 void ReServer::heapHandler(AsyncWebServerRequest *request)
 {
-    JsonDocument doc;
+    JsonDocument doc(jsonArena.begin());
     doc["Heap_size"] = ESP.getHeapSize();
     doc["Free_heap"] = ESP.getFreeHeap();
     doc["Min_Free_Heap"] = ESP.getMinFreeHeap();
     doc["Max_Alloc_Heap"] = ESP.getMaxAllocHeap();
 
-    String output;
-    serializeJson(doc, output);
-    request->send(200, "application/json", output);
+    // Percent of the free heap not available as one block, watch it under a command soak
+    uint32_t freeHeap = ESP.getFreeHeap();
+    doc["Fragmentation"] = freeHeap ? 100 - (uint32_t)((uint64_t)ESP.getMaxAllocHeap() * 100 / freeHeap) : 0;
+
+    sendJson(request, 200, doc);
+}
+
+void ReServer::tasksHandler(AsyncWebServerRequest *request)
+{
+    // Tasks sharing the cores with the BLE worker, names as created by the Arduino core, NimBLE and AsyncTCP
+    static const char *taskNames[] = { "loopTask", "nimble_host", "async_tcp" };
+
+    JsonDocument doc(jsonArena.begin());
+    uint32_t now = millis();
+    doc["uptime_ms"] = now;
+
+    JsonArray tasks = doc["tasks"].to<JsonArray>();
+
+    auto addTask = [&tasks](TaskHandle_t handle)
+    {
+        JsonObject item = tasks.add<JsonObject>();
+        item["name"] = pcTaskGetName(handle);
+        item["core"] = (int)xTaskGetCoreID(handle);
+        item["priority"] = uxTaskPriorityGet(handle);
+        item["stack_free"] = uxTaskGetStackHighWaterMark(handle);
+#if configGENERATE_RUN_TIME_STATS
+        item["run_time"] = ulTaskGetRunTimeCounter(handle);
+#endif
+        return item;
+    };
+
+    if (bleWorker && bleWorker->getHandle())
+    {
+        JsonObject item = addTask(bleWorker->getHandle());
+
+        // Measured by the worker itself, available without the FreeRTOS run time stats
+        item["busy_ms"] = bleWorker->getBusyTimeMs();
+        item["cpu_permille"] = now ? (uint32_t)((uint64_t)bleWorker->getBusyTimeMs() * 1000 / now) : 0;
+        item["loops"] = bleWorker->getLoops();
+        item["mailbox_high_water"] = bleWorker->getMailboxHighWater();
+        item["mailbox_dropped"] = bleWorker->getMailboxDropped();
+    }
+
+    for (const char *name : taskNames)
+    {
+        TaskHandle_t handle = xTaskGetHandle(name);
+
+        if (handle)
+        {
+            addTask(handle);
+        }
+    }
+
+    sendJson(request, 200, doc);
+}
+
+void ReServer::loopHandler(AsyncWebServerRequest *request)
+{
+    if (!loopProfiler)
+    {
+        request->send(503, "text/plain", "Loop profiler not initialized");
+        return;
+    }
+
+    JsonDocument doc(jsonArena.begin());
+    loopProfiler->toJson(doc.to<JsonObject>());
+
+    sendJson(request, 200, doc);
 }
 
 void ReServer::wifiInfoHandler(AsyncWebServerRequest *request)
@@ -138,10 +409,33 @@ void ReServer::adminClearHandler(AsyncWebServerRequest *request)
     ESP.restart();
 }
 
+// The page only changes with the firmware: browsers revalidate with the ETag set by tools/website.py and get a 304
 void ReServer::adminHandler(AsyncWebServerRequest *request)
 {
-    AsyncWebServerResponse *response = request->beginResponse(200, "text/html", (uint8_t *)(settings_html_start), settings_html_end - settings_html_start);
+    AsyncWebServerResponse *response;
+
+#ifdef RE_SETTINGS_ETAG
+    static const char *etag = "\"" RE_SETTINGS_ETAG "\"";
+
+    // If-None-Match may list several ETags
+    if (request->hasHeader("If-None-Match") && strstr(request->getHeader("If-None-Match")->value().c_str(), etag))
+    {
+        response = request->beginResponse(304);
+    }
+    else
+    {
+        response = request->beginResponse(200, "text/html", (uint8_t *)(settings_html_start), settings_html_end - settings_html_start);
+        response->addHeader("Content-Encoding", "gzip");
+    }
+
+    response->addHeader("ETag", etag);
+#else
+    response = request->beginResponse(200, "text/html", (uint8_t *)(settings_html_start), settings_html_end - settings_html_start);
     response->addHeader("Content-Encoding", "gzip");
+#endif
+
+    // Behind the admin password, keep it out of shared caches
+    response->addHeader("Cache-Control", "private, no-cache");
     request->send(response);
 }
 
@@ -160,10 +454,27 @@ void ReServer::adminSettingsGetHandler(AsyncWebServerRequest *request)
     doc["mqtt"]["username"] = config.getString("mqtt_user");
     doc["mqtt"]["password"] = config.getString("mqtt_pass");
     doc["bot"]["mac"] = config.getString("bot_mac");
+    doc["bot"]["password"] = config.getString("bot_pass");
     doc["bot"]["scantime"] = config.get<int>("bot_scantime");
     doc["bot"]["txpower"] = config.get<int>("bot_txpower");
+    doc["bot"]["idle"] = config.get<int>("bot_idle");
+    doc["bot"]["timeout_connect"] = config.get<int>("bot_to_conn");
+    doc["bot"]["timeout_subscribe"] = config.get<int>("bot_to_sub");
+    doc["bot"]["timeout_write"] = config.get<int>("bot_to_write");
+    doc["bot"]["timeout_notify"] = config.get<int>("bot_to_notify");
+    doc["bot"]["retries"] = config.get<int>("bot_retries");
+    doc["bot"]["retry_backoff"] = config.get<int>("bot_retry_ms");
+    doc["bot"]["breaker_failures"] = config.get<int>("bot_cb_fails");
+    doc["bot"]["breaker_open"] = config.get<int>("bot_cb_open");
+    doc["bot"]["direct"] = config.get<bool>("bot_direct");
+    doc["bot"]["whitelist"] = config.get<bool>("bot_whitelist");
+    doc["bot"]["sensors"] = config.get<bool>("sensor_en");
+    doc["bot"]["worker_core"] = config.get<int>("ble_core");
+    doc["bot"]["worker_priority"] = config.get<int>("ble_prio");
     doc["admin"]["password"] = config.getString("adm_pass");
     doc["admin"]["webserial"] = config.get<bool>("adm_webserial");
+    doc["admin"]["loop_stall"] = config.get<int>("loop_stall_ms");
+    doc["admin"]["loop_log"] = config.get<bool>("loop_log");
 
     response->setLength();
     request->send(response);
@@ -183,10 +494,27 @@ void ReServer::adminSettingsPostHandler(AsyncWebServerRequest *request, JsonVari
     config.setString("mqtt_user", doc["mqtt"]["username"].as<const char *>());
     config.setString("mqtt_pass", doc["mqtt"]["password"].as<const char *>());
     config.setString("bot_mac", doc["bot"]["mac"].as<const char *>());
+    config.setString("bot_pass", doc["bot"]["password"].as<const char *>());
     config.set<int>("bot_scantime", doc["bot"]["scantime"].as<int>());
     config.set<int>("bot_txpower", doc["bot"]["txpower"].as<int>());
+    config.set<int>("bot_idle", doc["bot"]["idle"].as<int>());
+    config.set<int>("bot_to_conn", doc["bot"]["timeout_connect"].as<int>());
+    config.set<int>("bot_to_sub", doc["bot"]["timeout_subscribe"].as<int>());
+    config.set<int>("bot_to_write", doc["bot"]["timeout_write"].as<int>());
+    config.set<int>("bot_to_notify", doc["bot"]["timeout_notify"].as<int>());
+    config.set<int>("bot_retries", doc["bot"]["retries"].as<int>());
+    config.set<int>("bot_retry_ms", doc["bot"]["retry_backoff"].as<int>());
+    config.set<int>("bot_cb_fails", doc["bot"]["breaker_failures"].as<int>());
+    config.set<int>("bot_cb_open", doc["bot"]["breaker_open"].as<int>());
+    config.set<bool>("bot_direct", doc["bot"]["direct"].as<bool>());
+    config.set<bool>("bot_whitelist", doc["bot"]["whitelist"].as<bool>());
+    config.set<bool>("sensor_en", doc["bot"]["sensors"].as<bool>());
+    config.set<int>("ble_core", doc["bot"]["worker_core"].as<int>());
+    config.set<int>("ble_prio", doc["bot"]["worker_priority"].as<int>());
     config.setString("adm_pass", doc["admin"]["password"].as<const char *>());
     config.set<bool>("adm_webserial", doc["admin"]["webserial"].as<bool>());
+    config.set<int>("loop_stall_ms", doc["admin"]["loop_stall"].as<int>());
+    config.set<bool>("loop_log", doc["admin"]["loop_log"].as<bool>());
 
     serializeJson(doc, Serial);
 
@@ -213,42 +541,531 @@ void ReServer::adminDecommissionHandler(AsyncWebServerRequest *request)
     request->send(200, "text/plain", "Decommissioning the Matter Accessory. It shall be commissioned again");
 }
 
+uint8_t ReServer::getRequestBotId(AsyncWebServerRequest *request)
+{
+    // Bot ID is optional, first configured Bot is used by default
+    if (request->hasParam("bot") && !request->getParam("bot")->value().isEmpty())
+    {
+        long id = request->getParam("bot")->value().toInt();
+        return (id >= 0 && id < RE_MAX_BOTS) ? (uint8_t)id : RE_BOT_INVALID_ID;
+    }
+
+    return 0;
+}
+
+void ReServer::enqueueCommand(AsyncWebServerRequest *request, uint8_t botId, const uint8_t *data, size_t length)
+{
+    if (!ctx.getBotPresent(botId))
+    {
+        request->send(200, "text/plain", "Device is not connected, command NOT executed");
+        return;
+    }
+
+    // Hold the lock until the waiter is registered, so the result can not arrive before it
+    std::lock_guard<std::mutex> lock(waitersLock);
+    ReWaiter *waiter = nullptr;
+
+    for (ReWaiter &slot : waiters)
+    {
+        if (0 == slot.correlationId)
+        {
+            waiter = &slot;
+            break;
+        }
+    }
+
+    if (!waiter)
+    {
+        request->send(503, "text/plain", "Too many pending requests, command NOT executed");
+        return;
+    }
+
+    uint32_t correlationId = 0;
+
+    switch (ctx.getCommandQueue().enqueue(botId, ReCommandOrigin::HTTP, data, length, correlationId))
+    {
+        case ReEnqueueResult::OK:
+            waiter->correlationId = correlationId;
+            waiter->botId = botId;
+            waiter->deadline = millis() + RE_WAITER_TIMEOUT_MS;
+            waiter->pausedAt = micros();
+            waiter->request = request->pause();
+            break;
+        case ReEnqueueResult::FULL:
+            request->send(503, "text/plain", "Command queue is full, command NOT executed");
+            break;
+        case ReEnqueueResult::INVALID:
+        default:
+            request->send(400, "text/plain", "Invalid command length");
+            break;
+    }
+}
+
 void ReServer::switchbotPressHandler(AsyncWebServerRequest *request)
 {
-    ctx.setDoCommand(BOT_PRESS_COMMAND);
+    const ReBotCommandSpec &press = reBotCommand(ReBotOpcode::PRESS);
+
+    enqueueCommand(request, getRequestBotId(request), press.data, press.length);
+}
 
-    if (ctx.getBleDeviceFound())
+void ReServer::switchbotCommandHandler(AsyncWebServerRequest *request)
+{
+    if (request->hasParam("cmd") && !request->getParam("cmd")->value().isEmpty())
     {
-        ctx.setDoConnect(true);
-        pressRequest = request->pause();
+        uint8_t data[RE_CMD_MAX_LENGTH];
+        size_t length = 0;
+        const char *error = nullptr;
+
+        if (!parseCommand(request->getParam("cmd")->value().c_str(), data, length, error))
+        {
+            request->send(400, "text/plain", error);
+            return;
+        }
+
+        enqueueCommand(request, getRequestBotId(request), data, length);
     }
     else
     {
-        request->send(200, "text/plain", "Device is not connected, command NOT executed...");
+        request->send(200, "text/plain", "Missing parameter");
     }
 }
 
-void ReServer::switchbotCommandHandler(AsyncWebServerRequest *request)
+void ReServer::switchbotBatchHandler(AsyncWebServerRequest *request, JsonVariant &json)
 {
-    String code;
+    struct Entry
+    {
+        uint8_t botId;
+        uint16_t delay;
+        uint8_t data[RE_CMD_MAX_LENGTH];
+        size_t length;
+    };
 
-    if (request->hasParam("cmd") && !request->getParam("cmd")->value().isEmpty())
+    JsonArray commands = json.as<JsonArray>();
+
+    if (commands.isNull() || 0 == commands.size() || commands.size() > RE_BATCH_MAX_COMMANDS)
+    {
+        request->send(400, "text/plain", "Expected a JSON array of 1 to 8 commands");
+        return;
+    }
+
+    Entry entries[RE_BATCH_MAX_COMMANDS];
+    uint8_t defaultBotId = getRequestBotId(request);
+    uint32_t totalDelay = 0;
+    size_t count = 0;
+
+    for (JsonVariant item : commands)
+    {
+        Entry &entry = entries[count++];
+        const char *error = nullptr;
+        int botId = item["bot"].is<int>() ? item["bot"].as<int>() : defaultBotId;
+        int delay = item["delay"].as<int>();
+
+        if (botId < 0 || botId >= RE_MAX_BOTS || delay < 0 || delay > RE_CMD_MAX_DELAY_MS)
+        {
+            request->send(400, "text/plain", "Invalid bot or delay");
+            return;
+        }
+
+        if (!item["cmd"].is<const char *>() || !parseCommand(item["cmd"].as<const char *>(), entry.data, entry.length, error))
+        {
+            request->send(400, "text/plain", error ? error : "Missing cmd");
+            return;
+        }
+
+        entry.botId = (uint8_t)botId;
+        entry.delay = (uint16_t)delay;
+        totalDelay += entry.delay;
+    }
+
+    // Delays run inside the command deadline, keep room for the commands themselves
+    if (totalDelay > RE_CMD_TIMEOUT_MS / 2)
+    {
+        request->send(400, "text/plain", "Total delay too long");
+        return;
+    }
+
+    // Group the commands per Bot, in the request order within a Bot, so each Bot runs its sequence
+    // back to back over one connection
+    size_t order[RE_BATCH_MAX_COMMANDS];
+    bool keepConnection[RE_BATCH_MAX_COMMANDS] = {};
+    bool taken[RE_BATCH_MAX_COMMANDS] = {};
+    size_t ordered = 0;
+
+    for (size_t i = 0; i < count; i++)
+    {
+        if (taken[i])
+        {
+            continue;
+        }
+
+        for (size_t j = i; j < count; j++)
+        {
+            if (taken[j] || entries[j].botId != entries[i].botId)
+            {
+                continue;
+            }
+
+            // Not the first command of the Bot, the one before keeps the connection open for it
+            if (j != i)
+            {
+                keepConnection[order[ordered - 1]] = true;
+            }
+
+            taken[j] = true;
+            order[ordered++] = j;
+        }
+    }
+
+    // Hold the lock until the batch is registered, so no result can arrive before it
+    std::lock_guard<std::mutex> lock(waitersLock);
+    ReBatchWaiter *batch = nullptr;
+
+    for (ReBatchWaiter &slot : batches)
+    {
+        if (0 == slot.count)
+        {
+            batch = &slot;
+            break;
+        }
+    }
+
+    if (!batch)
     {
-        code = request->getParam("cmd")->value();
-        ctx.setDoCommand(code.c_str());
+        request->send(503, "text/plain", "Too many pending batches, commands NOT executed");
+        return;
+    }
+
+    if (ctx.getCommandQueue().capacity() - ctx.getCommandQueue().depth() < count)
+    {
+        request->send(503, "text/plain", "Command queue is full, commands NOT executed");
+        return;
+    }
+
+    *batch = ReBatchWaiter();
+    batch->count = count;
 
-        if (ctx.getBleDeviceFound())
+    for (size_t k = 0; k < count; k++)
+    {
+        size_t i = order[k];
+        const Entry &entry = entries[i];
+        uint32_t correlationId = 0;
+
+        batch->botIds[i] = entry.botId;
+
+        if (!ctx.getBotPresent(entry.botId))
+        {
+            batch->results[i] = ReBotResult::failure("Device is not connected, command NOT executed");
+        }
+        else if (ReEnqueueResult::OK == ctx.getCommandQueue().enqueue(entry.botId, ReCommandOrigin::HTTP, entry.data, entry.length,
+                                                                      correlationId, entry.delay, keepConnection[i]))
         {
-            ctx.setDoConnect(true);
-            pressRequest = request->pause();
+            batch->correlationIds[i] = correlationId;
+            batch->pending++;
         }
         else
         {
-            request->send(200, "text/plain", "Device is not connected, command NOT executed");
+            batch->results[i] = ReBotResult::failure("Command queue is full, command NOT executed");
         }
     }
-    else
+
+    // Nothing queued, every result is known already
+    if (0 == batch->pending)
     {
-        request->send(200, "text/plain", "Missing parameter");
+        sendBatchJson(request, 200, *batch);
+        batch->count = 0;
+        return;
+    }
+
+    batch->deadline = millis() + RE_WAITER_TIMEOUT_MS + totalDelay;
+    batch->pausedAt = micros();
+    batch->request = request->pause();
+}
+
+bool ReServer::parseCommand(const char *text, uint8_t *data, size_t &length, const char *&error)
+{
+    ReBotOpcode opcode;
+
+    // Known commands by name or hex are taken from the table, anything else is decoded as hex
+    if (ReBotProtocol::lookup(text, opcode) && 0 == reBotCommand(opcode).argLength)
+    {
+        const ReBotCommandSpec &spec = reBotCommand(opcode);
+        memcpy(data, spec.data, spec.length);
+        length = spec.length;
+        return true;
     }
+
+    ReHexStatus status = stringToHexArray(text, data, RE_CMD_MAX_LENGTH, length);
+
+    if (ReHexStatus::OK != status)
+    {
+        error = hexStatusName(status);
+        return false;
+    }
+
+    return true;
+}
+
+void ReServer::switchbotQueueHandler(AsyncWebServerRequest *request)
+{
+    ReCommandQueue &queue = ctx.getCommandQueue();
+
+    JsonDocument doc(jsonArena.begin());
+    doc["depth"] = queue.depth();
+    doc["capacity"] = queue.capacity();
+    doc["high_water"] = queue.getHighWater();
+    doc["enqueued"] = queue.getEnqueued();
+    doc["dropped"] = queue.getDropped();
+
+    // Taken off the queue by the BLE worker, waiting for their Bot
+    if (bleWorker)
+    {
+        doc["backlog"] = bleWorker->getBacklog();
+    }
+
+    sendJson(request, 200, doc);
+}
+
+void ReServer::switchbotBotsHandler(AsyncWebServerRequest *request)
+{
+    JsonDocument doc(jsonArena.begin());
+    JsonArray bots = doc.to<JsonArray>();
+    char mac[18];
+    uint32_t now = millis();
+
+    for (ReBot &bot : ctx.getBotRegistry())
+    {
+        ReBotRegistry::formatAddress(bot.address, mac);
+
+        JsonObject item = bots.add<JsonObject>();
+        item["id"] = bot.id;
+        item["mac"] = mac;
+        item["state"] = (uint8_t)bot.state;
+        item["password"] = bot.hasPassword;
+        ReBotProtocol::advertisementToJson(bot, now, item);
+        item["connected"] = (nullptr != bot.client) && bot.client->isConnected();
+        item["connects"] = bot.connects;
+        item["reuses"] = bot.reuses;
+        item["evictions"] = bot.evictions;
+
+        if (bleDevice)
+        {
+            const ReCircuitBreaker &breaker = bleDevice->getBreaker(bot.id);
+
+            JsonObject circuit = item["breaker"].to<JsonObject>();
+            circuit["state"] = ReCircuitBreaker::stateName(breaker.getState());
+            circuit["failures"] = breaker.getFailures();
+            circuit["trips"] = breaker.getTrips();
+            circuit["probe_in_ms"] = breaker.getOpenTimeLeft(now);
+        }
+    }
+
+    sendJson(request, 200, doc);
+}
+
+// Latest reading of every Switchbot sensor heard by the scanner
+void ReServer::switchbotSensorsHandler(AsyncWebServerRequest *request)
+{
+    const ReSensorStore &store = ctx.getSensors();
+    const ReSensorStats &stats = store.getStats();
+    uint32_t now = millis();
+
+    JsonDocument doc(jsonArena.begin());
+    JsonObject root = doc.to<JsonObject>();
+    root["advertisements"] = stats.advertisements;
+    root["decoded"] = stats.decoded;
+    root["unknown"] = stats.unknown;
+    root["replaced"] = stats.replaced;
+
+    JsonArray sensors = root["sensors"].to<JsonArray>();
+    ReSensorSnapshot snapshot;
+
+    for (size_t i = 0; i < store.capacity(); i++)
+    {
+        if (store.read(i, snapshot))
+        {
+            ReSensorStore::toJson(snapshot, now, sensors.add<JsonObject>());
+        }
+    }
+
+    sendJson(request, 200, doc);
+}
+
+// Current state of every command session and the state timeline of its last finished command
+void ReServer::switchbotSessionsHandler(AsyncWebServerRequest *request)
+{
+    if (!bleDevice)
+    {
+        request->send(503, "text/plain", "BLE not initialized");
+        return;
+    }
+
+    JsonDocument doc(jsonArena.begin());
+    JsonArray sessions = doc.to<JsonArray>();
+
+    for (ReBot &bot : ctx.getBotRegistry())
+    {
+        const ReCommandSession &session = bleDevice->getSession(bot.id);
+        const uint32_t *timeline = session.getTimeline();
+
+        JsonObject item = sessions.add<JsonObject>();
+        item["bot"] = bot.id;
+        item["state"] = ReCommandSession::stateName(session.getState());
+        item["last_id"] = session.getLastCorrelationId();
+
+        // Microseconds from the scan hit to each visited state
+        JsonObject times = item["timeline_us"].to<JsonObject>();
+
+        for (size_t i = (size_t)ReSessionState::CONNECTING; i < (size_t)ReSessionState::COUNT; i++)
+        {
+            if (timeline[i])
+            {
+                times[ReCommandSession::stateName((ReSessionState)i)] = timeline[i];
+            }
+        }
+    }
+
+    sendJson(request, 200, doc);
+}
+
+void ReServer::switchbotScanHandler(AsyncWebServerRequest *request)
+{
+    if (!bleDevice)
+    {
+        request->send(503, "text/plain", "BLE not initialized");
+        return;
+    }
+
+    const ReScanStats &stats = bleDevice->getScanStats();
+
+    JsonDocument doc(jsonArena.begin());
+    doc["advertisements"] = stats.advertisements;
+    doc["matched"] = stats.matched;
+    doc["avg_cycles"] = stats.advertisements ? (uint32_t)(stats.cycles / stats.advertisements) : 0;
+    doc["max_cycles"] = stats.maxCycles;
+
+    // Duty cycles are in per mille
+    const ReScanScheduler &scheduler = bleDevice->getScanScheduler();
+    uint32_t now = millis();
+
+    doc["mode"] = ReScanScheduler::modeName(scheduler.getMode());
+    doc["duty_cycle"] = ReScanScheduler::getDutyCycle(scheduler.getMode());
+    doc["avg_duty_cycle"] = scheduler.getAverageDutyCycle(now);
+    doc["passive_enough"] = scheduler.isPassiveEnough();
+
+    JsonObject modes = doc["modes"].to<JsonObject>();
+
+    for (size_t i = 0; i < (size_t)ReScanMode::COUNT; i++)
+    {
+        ReScanMode mode = (ReScanMode)i;
+        const ReScanModeStats &modeStats = scheduler.getStats(mode);
+
+        JsonObject item = modes[ReScanScheduler::modeName(mode)].to<JsonObject>();
+        item["duty_cycle"] = ReScanScheduler::getDutyCycle(mode);
+        item["enters"] = modeStats.enters;
+        item["time_ms"] = scheduler.getTimeInMode(mode, now);
+        item["first_adv_ms"] = modeStats.firstAdvLast;
+        item["first_adv_avg_ms"] = modeStats.firstAdvAvg;
+    }
+
+    // Advertisements reaching the host per filter policy, what the controller whitelist saves
+    doc["filter"] = ReScanScheduler::filterName(scheduler.getFilter());
+
+    JsonObject filters = doc["filters"].to<JsonObject>();
+    uint32_t hostUnmatchedRate = 0;
+
+    for (size_t i = 0; i < (size_t)ReScanFilter::COUNT; i++)
+    {
+        ReScanFilter filter = (ReScanFilter)i;
+        uint32_t timeMs = scheduler.getTimeInFilter(filter, now);
+        uint32_t unmatched = stats.filterAdvertisements[i] - stats.filterMatched[i];
+        uint32_t unmatchedRate = timeMs ? (uint32_t)((uint64_t)unmatched * 60000 / timeMs) : 0;
+
+        JsonObject item = filters[ReScanScheduler::filterName(filter)].to<JsonObject>();
+        item["time_ms"] = timeMs;
+        item["advertisements"] = stats.filterAdvertisements[i];
+        item["matched"] = stats.filterMatched[i];
+        item["unmatched"] = unmatched;
+        item["unmatched_per_min"] = unmatchedRate;
+
+        if (ReScanFilter::HOST == filter)
+        {
+            hostUnmatchedRate = unmatchedRate;
+        }
+        else
+        {
+            // Estimate from the host filter rate, the controller does not count what it drops
+            item["dropped_estimate"] = (uint32_t)((uint64_t)hostUnmatchedRate * timeMs / 60000);
+        }
+    }
+
+    sendJson(request, 200, doc);
+}
+
+// Prometheus text format, only relaxed loads of counters kept up to date by the BLE worker and the NimBLE task
+void ReServer::metricsHandler(AsyncWebServerRequest *request)
+{
+    // Sized up front, a growing buffer would be reallocated several times for the multi-KB body
+    AsyncResponseStream *response = request->beginResponseStream("text/plain; version=0.0.4", metricsLength + RE_METRICS_SLACK);
+
+    ctx.getMetrics().print(*response);
+    ctx.getEventBus().print(*response);
+
+    response->print("# TYPE blegateway_heap_free_bytes gauge\n");
+    response->printf("blegateway_heap_free_bytes %lu\n", ESP.getFreeHeap());
+    response->print("# TYPE blegateway_heap_min_free_bytes gauge\n");
+    response->printf("blegateway_heap_min_free_bytes %lu\n", ESP.getMinFreeHeap());
+    response->print("# TYPE blegateway_heap_max_alloc_bytes gauge\n");
+    response->printf("blegateway_heap_max_alloc_bytes %lu\n", ESP.getMaxAllocHeap());
+
+    response->print("# TYPE blegateway_json_documents_total counter\n");
+    response->printf("blegateway_json_documents_total %lu\n", jsonArena.getDocuments());
+    response->print("# TYPE blegateway_json_arena_peak_bytes gauge\n");
+    response->printf("blegateway_json_arena_peak_bytes %u\n", jsonArena.getPeak());
+    response->print("# TYPE blegateway_json_arena_overflows_total counter\n");
+    response->printf("blegateway_json_arena_overflows_total %lu\n", jsonArena.getOverflows());
+
+    ReCommandQueue &queue = ctx.getCommandQueue();
+
+    response->print("# TYPE blegateway_queue_depth gauge\n");
+    response->printf("blegateway_queue_depth %u\n", queue.depth());
+    response->print("# TYPE blegateway_queue_enqueued_total counter\n");
+    response->printf("blegateway_queue_enqueued_total %lu\n", queue.getEnqueued());
+    response->print("# TYPE blegateway_queue_dropped_total counter\n");
+    response->printf("blegateway_queue_dropped_total %lu\n", queue.getDropped());
+
+    response->print("# TYPE blegateway_stream_clients gauge\n");
+    response->printf("blegateway_stream_clients %u\n", stream.getClientCount());
+    response->print("# TYPE blegateway_stream_sent_total counter\n");
+    response->printf("blegateway_stream_sent_total %lu\n", stream.getSent());
+    response->print("# TYPE blegateway_stream_dropped_total counter\n");
+    response->printf("blegateway_stream_dropped_total %lu\n", stream.getDropped());
+
+    if (bleDevice)
+    {
+        const ReScanStats &stats = bleDevice->getScanStats();
+
+        response->print("# TYPE blegateway_scan_advertisements_total counter\n");
+        response->printf("blegateway_scan_advertisements_total %lu\n", stats.advertisements);
+        response->print("# TYPE blegateway_scan_matched_total counter\n");
+        response->printf("blegateway_scan_matched_total %lu\n", stats.matched);
+    }
+
+    if (bleWorker)
+    {
+        response->print("# TYPE blegateway_worker_busy_ms_total counter\n");
+        response->printf("blegateway_worker_busy_ms_total %lu\n", bleWorker->getBusyTimeMs());
+        response->print("# TYPE blegateway_worker_backlog gauge\n");
+        response->printf("blegateway_worker_backlog %lu\n", bleWorker->getBacklog());
+        response->print("# TYPE blegateway_worker_mailbox_dropped_total counter\n");
+        response->printf("blegateway_worker_mailbox_dropped_total %lu\n", bleWorker->getMailboxDropped());
+
+        if (bleWorker->getHandle())
+        {
+            response->print("# TYPE blegateway_worker_stack_free_bytes gauge\n");
+            response->printf("blegateway_worker_stack_free_bytes %u\n", uxTaskGetStackHighWaterMark(bleWorker->getHandle()));
+        }
+    }
+
+    metricsLength = response->available();
+    request->send(response);
 }
@@ -2,7 +2,45 @@
 
 #include <ESPAsyncWebServer.h>
 #include <MycilaESPConnect.h>
+#include <mutex>
+#include "ReBotProtocol.h"
 #include "ReContext.h"
+#include "ReJsonArena.h"
+#include "ReStream.h"
+
+#define RE_MAX_WAITERS 16                               // paused HTTP requests waiting for a Bot result
+#define RE_WAITER_TIMEOUT_MS (RE_CMD_TIMEOUT_MS + 5000) // queue timeout plus the longest command run
+#define RE_MAX_BATCHES 2                                // paused batch requests
+#define RE_BATCH_MAX_COMMANDS 8
+#define RE_METRICS_LENGTH 6144                          // first /metrics buffer, later ones are sized by the previous body
+#define RE_METRICS_SLACK 512                            // room for counters which gained digits since
+
+class ReBLEDevice;
+class ReBLEWorker;
+class ReLoopProfiler;
+
+// Paused HTTP request waiting for the result of the command with the given correlation ID, 0 is a free slot
+struct ReWaiter
+{
+    uint32_t correlationId = 0;
+    uint32_t deadline = 0;
+    uint32_t pausedAt = 0;      // micros(), for the HTTP latency
+    uint8_t botId = 0;
+    AsyncWebServerRequestPtr request;
+};
+
+// Paused batch request, answered when the results of all its commands are in; count 0 is a free slot
+struct ReBatchWaiter
+{
+    uint8_t count = 0;
+    uint8_t pending = 0;
+    uint32_t deadline = 0;
+    uint32_t pausedAt = 0;
+    uint32_t correlationIds[RE_BATCH_MAX_COMMANDS] = {};   // in the request order, 0 once answered
+    uint8_t botIds[RE_BATCH_MAX_COMMANDS] = {};
+    ReBotResult results[RE_BATCH_MAX_COMMANDS];
+    AsyncWebServerRequestPtr request;
+};
 
 class ReServer : public AsyncWebServer
 {
@@ -11,7 +49,15 @@ public:
 
     void begin();
     void setESPConnect(Mycila::ESPConnect *esp);
-    void pressRequestNotifyJson(const std::string& resultData);
+    void setBLEDevice(const ReBLEDevice *device);
+    void setBLEWorker(const ReBLEWorker *worker);
+    void setLoopProfiler(const ReLoopProfiler *profiler);
+    void pressRequestNotifyJson(uint32_t correlationId, uint8_t botId, const ReBotResult& result);
+
+    // Answer the waiters which have passed their deadline and push the stream messages, called from the main loop
+    void loop();
+
+    ReStream &getStream() { return stream; }
 
 private:
     void setAuthenticationMiddleware();
@@ -20,6 +66,8 @@ private:
     void handleRoot(AsyncWebServerRequest *request);
     void handleNotFound(AsyncWebServerRequest *request);
     void heapHandler(AsyncWebServerRequest *request);
+    void tasksHandler(AsyncWebServerRequest *request);
+    void loopHandler(AsyncWebServerRequest *request);
     void wifiInfoHandler(AsyncWebServerRequest *request);
     void adminClearHandler(AsyncWebServerRequest *request);
     void adminHandler(AsyncWebServerRequest *request);
@@ -30,9 +78,37 @@ private:
     void adminDecommissionHandler(AsyncWebServerRequest *request);
     void switchbotPressHandler(AsyncWebServerRequest *request);
     void switchbotCommandHandler(AsyncWebServerRequest *request);
+    void switchbotBatchHandler(AsyncWebServerRequest *request, JsonVariant &json);
+    void switchbotBotsHandler(AsyncWebServerRequest *request);
+    void switchbotQueueHandler(AsyncWebServerRequest *request);
+    void switchbotSessionsHandler(AsyncWebServerRequest *request);
+    void switchbotScanHandler(AsyncWebServerRequest *request);
+    void switchbotSensorsHandler(AsyncWebServerRequest *request);
+    void metricsHandler(AsyncWebServerRequest *request);
+
+    uint8_t getRequestBotId(AsyncWebServerRequest *request);
+    void enqueueCommand(AsyncWebServerRequest *request, uint8_t botId, const uint8_t *data, size_t length);
+    static void sendResultJson(AsyncWebServerRequest *request, int code, uint8_t botId, const ReBotResult& result);
+    static void sendBatchJson(AsyncWebServerRequest *request, int code, const ReBatchWaiter &batch);
+    static void sendJson(AsyncWebServerRequest *request, int code, const JsonDocument &doc);
+    static bool parseCommand(const char *text, uint8_t *data, size_t &length, const char *&error);
 
     ReContext ctx;
     Mycila::ESPConnect *espConnect;
+    const ReBLEDevice *bleDevice = nullptr;
+    const ReBLEWorker *bleWorker = nullptr;
+    const ReLoopProfiler *loopProfiler = nullptr;
     AsyncAuthenticationMiddleware basicAuth;
-    AsyncWebServerRequestPtr pressRequest;
+    ReStream stream;
+
+    // Backing store of the JSON documents built by the handlers, AsyncTCP task only
+    ReJsonArena jsonArena;
+
+    // Length of the last /metrics body, AsyncTCP task only
+    size_t metricsLength = RE_METRICS_LENGTH;
+
+    // Filled by the AsyncTCP task, completed by the main loop; responses are sent outside of the lock
+    std::array<ReWaiter, RE_MAX_WAITERS> waiters;
+    std::array<ReBatchWaiter, RE_MAX_BATCHES> batches;
+    std::mutex waitersLock;
 };
@@ -0,0 +1,245 @@
+#include "ReStream.h"
+#include "ReCommon.h"
+
+ReStream::ReStream() : events("/events"), ws("/ws")
+{
+}
+
+void ReStream::begin(AsyncWebServer &server)
+{
+    events.onConnect([this](AsyncEventSourceClient *client)
+    {
+        if (!addClient(client, 0))
+        {
+            client->send("too many clients", "error");
+        }
+    });
+
+    events.onDisconnect([this](AsyncEventSourceClient *client)
+    {
+        removeClient(client, 0);
+    });
+
+    ws.onEvent([this](AsyncWebSocket *, AsyncWebSocketClient *client, AwsEventType type, void *, uint8_t *, size_t)
+    {
+        if (WS_EVT_CONNECT == type)
+        {
+            if (!addClient(nullptr, client->id()))
+            {
+                client->text("{\"type\":\"error\",\"payload\":\"too many clients\"}");
+            }
+        }
+        else if (WS_EVT_DISCONNECT == type)
+        {
+            removeClient(nullptr, client->id());
+        }
+    });
+
+    server.addHandler(&events);
+    server.addHandler(&ws);
+}
+
+bool ReStream::addClient(AsyncEventSourceClient *sse, uint32_t wsId)
+{
+    std::lock_guard<std::mutex> lock(clientsLock);
+
+    for (ReStreamClient &client : clients)
+    {
+        if (client.isFree())
+        {
+            client = ReStreamClient();
+            client.sse = sse;
+            client.wsId = wsId;
+            client.next = head.load(std::memory_order_acquire);
+
+            clientCount.fetch_add(1, std::memory_order_relaxed);
+
+            // New dashboard needs the current Bot state, not only the changes
+            snapshotPending.store(true, std::memory_order_relaxed);
+            return true;
+        }
+    }
+
+    return false;
+}
+
+void ReStream::removeClient(AsyncEventSourceClient *sse, uint32_t wsId)
+{
+    std::lock_guard<std::mutex> lock(clientsLock);
+
+    for (ReStreamClient &client : clients)
+    {
+        if (!client.isFree() && client.sse == sse && client.wsId == wsId)
+        {
+            client = ReStreamClient();
+            clientCount.fetch_sub(1, std::memory_order_relaxed);
+            return;
+        }
+    }
+}
+
+void ReStream::publishResult(const ReCommand &command, const ReBotResult &result)
+{
+    if (0 == getClientCount())
+    {
+        return;
+    }
+
+    JsonDocument doc;
+    JsonObject root = doc.to<JsonObject>();
+    ReBotProtocol::toJson(command.botId, result, root);
+    root["id"] = command.correlationId;
+
+    publish("result", doc);
+}
+
+void ReStream::loop()
+{
+    uint32_t now = millis();
+
+    // WebSocket clients which went away without a close frame
+    ws.cleanupClients(RE_STREAM_MAX_CLIENTS);
+
+    if (0 == getClientCount())
+    {
+        return;
+    }
+
+    if ((now - stateCheckedAt) >= RE_STREAM_STATE_MS || snapshotPending.load(std::memory_order_relaxed))
+    {
+        stateCheckedAt = now;
+        publishState(now);
+    }
+
+    if ((now - metricsAt) >= RE_STREAM_METRICS_MS)
+    {
+        metricsAt = now;
+        publishMetrics();
+    }
+
+    pump();
+}
+
+void ReStream::publish(const char *type, JsonDocument &doc)
+{
+    uint32_t sequence = head.load(std::memory_order_relaxed);
+    ReStreamMessage &message = backlog[sequence % RE_STREAM_BACKLOG];
+
+    doc["type"] = type;
+
+    message.sequence = sequence;
+    message.type = type;
+    serializeJson(doc, message.text, sizeof(message.text));
+
+    head.store(sequence + 1, std::memory_order_release);
+}
+
+void ReStream::publishState(uint32_t now)
+{
+    bool snapshot = snapshotPending.exchange(false, std::memory_order_relaxed);
+
+    for (ReBot &bot : ctx.getBotRegistry())
+    {
+        ReBotPresence botPresence = bot.getPresence(now);
+
+        if (snapshot || botPresence != presence[bot.id])
+        {
+            presence[bot.id] = botPresence;
+            battery[bot.id] = bot.adv.battery;
+
+            JsonDocument doc;
+            JsonObject root = doc.to<JsonObject>();
+            root["bot"] = bot.id;
+            ReBotProtocol::advertisementToJson(bot, now, root);
+            publish("presence", doc);
+        }
+        else if (bot.adv.battery != battery[bot.id])
+        {
+            battery[bot.id] = bot.adv.battery;
+
+            JsonDocument doc;
+            doc["bot"] = bot.id;
+            doc["battery"] = bot.adv.battery;
+            publish("battery", doc);
+        }
+    }
+}
+
+void ReStream::publishMetrics()
+{
+    ReMetrics &metrics = ctx.getMetrics();
+    JsonDocument doc;
+    bool changed = false;
+
+    // Counter increments since the last message, nothing is sent while idle
+    for (size_t i = 0; i < (size_t)ReCommandOutcome::COUNT; i++)
+    {
+        ReCommandOutcome outcome = (ReCommandOutcome)i;
+        uint32_t count = metrics.getCount(outcome);
+
+        doc[ReMetrics::outcomeName(outcome)] = count - lastOutcomes[i];
+        changed |= count != lastOutcomes[i];
+        lastOutcomes[i] = count;
+    }
+
+    uint32_t retries = metrics.getRetries();
+    doc["retries"] = retries - lastRetries;
+    changed |= retries != lastRetries;
+    lastRetries = retries;
+
+    if (!changed)
+    {
+        return;
+    }
+
+    doc["queue_depth"] = ctx.getCommandQueue().depth();
+    doc["interval_ms"] = RE_STREAM_METRICS_MS;
+    publish("metrics", doc);
+}
+
+void ReStream::pump()
+{
+    std::lock_guard<std::mutex> lock(clientsLock);
+    uint32_t end = head.load(std::memory_order_relaxed);
+
+    for (ReStreamClient &client : clients)
+    {
+        if (client.isFree())
+        {
+            continue;
+        }
+
+        // Fell behind the ring, skip to the oldest message still there
+        if ((end - client.next) > RE_STREAM_BACKLOG)
+        {
+            uint32_t skipped = end - client.next - RE_STREAM_BACKLOG;
+
+            client.dropped += skipped;
+            dropped.fetch_add(skipped, std::memory_order_relaxed);
+            client.next = end - RE_STREAM_BACKLOG;
+        }
+
+        AsyncWebSocketClient *wsClient = client.wsId ? ws.client(client.wsId) : nullptr;
+
+        while (client.next != end)
+        {
+            const ReStreamMessage &message = backlog[client.next % RE_STREAM_BACKLOG];
+
+            if (client.sse)
+            {
+                if (client.sse->packetsWaiting() >= RE_STREAM_IN_FLIGHT || !client.sse->send(message.text, message.type, message.sequence))
+                {
+                    break;
+                }
+            }
+            else if (!wsClient || wsClient->queueLen() >= RE_STREAM_IN_FLIGHT || !wsClient->text(message.text))
+            {
+                break;
+            }
+
+            client.next++;
+            client.sent++;
+            sent.fetch_add(1, std::memory_order_relaxed);
+        }
+    }
+}
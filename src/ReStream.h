@@ -0,0 +1,89 @@
+#pragma once
+
+#include <ESPAsyncWebServer.h>
+#include <atomic>
+#include <mutex>
+#include "ReContext.h"
+
+#define RE_STREAM_MAX_CLIENTS 4             // SSE and WebSocket subscribers together
+#define RE_STREAM_BACKLOG 16                // last messages, the bounded queue of every client
+#define RE_STREAM_IN_FLIGHT 2               // messages handed to the AsyncTCP queue of one client
+#define RE_STREAM_MESSAGE_LENGTH 256
+#define RE_STREAM_STATE_MS 1000             // presence and battery check period
+#define RE_STREAM_METRICS_MS 10000          // metrics delta period
+
+// Pushed message, the type is the SSE event name and the "type" member of the WebSocket message
+struct ReStreamMessage
+{
+    uint32_t sequence = 0;
+    const char *type = "";
+    char text[RE_STREAM_MESSAGE_LENGTH];
+};
+
+struct ReStreamClient
+{
+    AsyncEventSourceClient *sse = nullptr;
+    uint32_t wsId = 0;                      // WebSocket client ID, 0 for SSE
+    uint32_t next = 0;                      // sequence of the next message to send
+    uint32_t sent = 0;
+    uint32_t dropped = 0;
+
+    bool isFree() const { return !sse && !wsId; }
+};
+
+/**
+ * Push of command results, Bot presence / battery changes and metrics deltas to dashboards over
+ * Server-Sent Events (/events) and WebSocket (/ws). Messages go to one shared ring, every client
+ * only keeps a cursor into it and at most RE_STREAM_IN_FLIGHT messages in the AsyncTCP queue.
+ * A slow client falls behind the ring and skips to the oldest message still there (drop oldest),
+ * so it costs no more heap than a fast one. Messages are added and sent from the main loop.
+ */
+class ReStream
+{
+public:
+    ReStream();
+
+    void begin(AsyncWebServer &server);
+
+    // Main loop
+    void publishResult(const ReCommand &command, const ReBotResult &result);
+    void loop();
+
+    size_t getClientCount() const { return clientCount.load(std::memory_order_relaxed); }
+    uint32_t getSent() const { return sent.load(std::memory_order_relaxed); }
+    uint32_t getDropped() const { return dropped.load(std::memory_order_relaxed); }
+
+private:
+    bool addClient(AsyncEventSourceClient *sse, uint32_t wsId);
+    void removeClient(AsyncEventSourceClient *sse, uint32_t wsId);
+
+    void publish(const char *type, JsonDocument &doc);
+    void publishState(uint32_t now);
+    void publishMetrics();
+    void pump();
+
+    ReContext ctx;
+    AsyncEventSource events;
+    AsyncWebSocket ws;
+
+    // Written by the main loop, head is published after the message; read by addClient() on the AsyncTCP task
+    ReStreamMessage backlog[RE_STREAM_BACKLOG];
+    std::atomic<uint32_t> head { 0 };       // sequence of the next message
+
+    // Added and removed by the AsyncTCP task, walked by the main loop
+    ReStreamClient clients[RE_STREAM_MAX_CLIENTS];
+    std::mutex clientsLock;
+    std::atomic<uint32_t> clientCount { 0 };
+    std::atomic<bool> snapshotPending { false };    // set by the AsyncTCP task, taken by the main loop
+
+    ReBotPresence presence[RE_MAX_BOTS] = {};
+    uint8_t battery[RE_MAX_BOTS] = {};
+    uint32_t stateCheckedAt = 0;
+
+    uint32_t metricsAt = 0;
+    uint32_t lastOutcomes[(size_t)ReCommandOutcome::COUNT] = {};
+    uint32_t lastRetries = 0;
+
+    std::atomic<uint32_t> sent { 0 };
+    std::atomic<uint32_t> dropped { 0 };
+};
@@ -5,72 +5,261 @@
 #include <PsychicMqttClient.h>
 #include "ReBLEDevice.h"
 #include "ReBLEUtils.h"
+#include "ReBLEWorker.h"
 #include "ReLED.h"
+#include "ReLoopProfiler.h"
 #include "ReServer.h"
 
 static PsychicMqttClient mqttClient;
 static ReContext ctx;
 static ReBLEDevice bleDevice;
-static MatterOnOffPlugin onOffPlugin;
+static ReBLEWorker bleWorker;
+static ReLoopProfiler loopProfiler;
+static MatterOnOffPlugin onOffPlugins[RE_MAX_BOTS];
 
 ReServer* server = nullptr;
 Mycila::ESPConnect* espConnect = nullptr;
 
-// Task to turn off the switch and update the state after a delay
-Mycila::Task offSwitchTask("Turn Off", [](void* params){
-    logger.info(RE_TAG, "-> OFF Switch to false");
 
-    if (config.get<bool>("dev_matter"))
+// Cached advertisement state of the Bot, costs no radio time
+void publishBotState(const ReBot& bot, uint32_t now)
+{
+    static char payload[256];
+
+    JsonDocument doc;
+    JsonObject state = doc.to<JsonObject>();
+    state["bot"] = bot.id;
+    ReBotProtocol::advertisementToJson(bot, now, state);
+    serializeJson(doc, payload, sizeof(payload));
+
+    char topic[32];
+    snprintf(topic, sizeof(topic), "blegateway/state/%d", bot.id);
+    mqttClient.publish(topic, 1, true, payload); 
+}
+
+// Task to publish the Bot state over MQTT when the presence changes, or at least once a minute
+Mycila::Task botStateTask("Bot State", [](void* params){
+    static ReBotPresence publishedPresence[RE_MAX_BOTS];
+    static uint32_t publishedAt[RE_MAX_BOTS];
+
+    uint32_t now = millis();
+
+    for (ReBot &bot : ctx.getBotRegistry())
     {
-        onOffPlugin.setOnOff(false);
-        onOffPlugin.updateAccessory();
+        ReBotPresence presence = bot.getPresence(now);
+
+        if (0 != publishedAt[bot.id] && presence == publishedPresence[bot.id] && (now - publishedAt[bot.id]) < 60000)
+        {
+            continue;
+        }
+
+        publishedPresence[bot.id] = presence;
+        publishedAt[bot.id] = now;
+        publishBotState(bot, now);
     }
+});
 
-    if (config.get<bool>("mqtt_en"))
+void publishSensor(const ReSensorSnapshot& snapshot, uint32_t now)
+{
+    static char payload[256];
+
+    JsonDocument doc;
+    ReSensorStore::toJson(snapshot, now, doc.to<JsonObject>());
+    serializeJson(doc, payload, sizeof(payload));
+
+    char topic[40];
+    snprintf(topic, sizeof(topic), "blegateway/sensor/%012llx", (unsigned long long)snapshot.address);
+    mqttClient.publish(topic, 1, true, payload); 
+}
+
+// Task to publish the sensor readings over MQTT when they change, or at least once a minute
+Mycila::Task sensorTask("Sensors", [](void* params){
+    static ReSensorReading published[RE_MAX_SENSORS];
+    static uint64_t publishedAddress[RE_MAX_SENSORS];
+    static uint32_t publishedAt[RE_MAX_SENSORS];
+
+    ReSensorSnapshot snapshot;
+    uint32_t now = millis();
+
+    for (size_t i = 0; i < ctx.getSensors().capacity(); i++)
     {
-        mqttClient.publish("blegateway/result", 1, false, (char*)params); 
+        if (!ctx.getSensors().read(i, snapshot))
+        {
+            continue;
+        }
+
+        if (snapshot.address == publishedAddress[i] && snapshot.reading.sameState(published[i]) && (now - publishedAt[i]) < 60000)
+        {
+            continue;
+        }
+
+        published[i] = snapshot.reading;
+        publishedAddress[i] = snapshot.address;
+        publishedAt[i] = now;
+        publishSensor(snapshot, now);
     }
+});
+
+// Typed result fields of the get basic info command, published next to the raw result
+void publishBotInfo(uint8_t botId, const ReBotResult& result)
+{
+    static char payload[192];
+
+    JsonDocument doc;
+    ReBotProtocol::toJson(botId, result, doc.to<JsonObject>());
+    serializeJson(doc, payload, sizeof(payload));
 
+    char topic[32];
+    snprintf(topic, sizeof(topic), "blegateway/info/%d", botId);
+    mqttClient.publish(topic, 1, true, payload); 
+}
+
+// Result sink, answers the paused HTTP requests waiting for this command
+void httpResultSink(const ReResultEvent& event)
+{
+    server->pressRequestNotifyJson(event.command.correlationId, event.command.botId, event.result);
+}
+
+// Result sink, pushes the result to the SSE and WebSocket subscribers
+void streamResultSink(const ReResultEvent& event)
+{
+    server->getStream().publishResult(event.command, event.result);
+}
+
+// Result sink on its own task, a slow broker only delays the MQTT messages
+void mqttResultSink(const ReResultEvent& event)
+{
+    uint8_t botId = event.command.botId;
+
+    char topic[32];
+    snprintf(topic, sizeof(topic), "blegateway/result/%d", botId);
+    mqttClient.publish(topic, 1, false, event.text); 
+
+    // First Bot keeps publishing to the original topic
+    if (0 == botId)
+    {
+        mqttClient.publish("blegateway/result", 1, false, event.text); 
+    }
+
+    if (event.result.hasInfo)
+    {
+        publishBotInfo(botId, event.result);
+    }
+}
+
+// Delayed result sink, turns the Matter switch off again after the press
+void matterResultSink(const ReResultEvent& event)
+{
+    logger.info(RE_TAG, "-> OFF Switch %d to false", event.command.botId);
+
+    onOffPlugins[event.command.botId].setOnOff(false);
+    onOffPlugins[event.command.botId].updateAccessory();
+}
+
+// Delayed result sink, the result color stays on for a while
+void ledResultSink(const ReResultEvent& event)
+{
     LED_COLOR_UPDATE(LED_COLOR_GREEN);
     LED_STATUS_UPDATE(start(LED_BLE_IDLE));
-});
-
+}
 
-// Notification receiving handler callback
-void updateAndNotifyWithBleData(std::string& resultData)
+// Command finished handler, the COMMAND_DONE event of the BLE worker
+void onBotCommandDone(const ReCommand& command, const ReBotResult& result)
 {
-    server->pressRequestNotifyJson(resultData);
+    // If we failed to connect or execute the command, show it until the LED sink resets the color
+    if (result.error)
+    {
+        LED_COLOR_UPDATE(LED_COLOR_RED);
+        LED_STATUS_UPDATE(start(LED_BLE_ALERT));
+    }
 
-    offSwitchTask.resume(RE_TASK_RESUME_TIME_MS);
-    offSwitchTask.setData((void*)resultData.c_str());
+    ctx.getEventBus().publish(command, result);
 
-    logger.info(RE_TAG, "Updated accessory with BLE data: %s", resultData.c_str());
+    logger.info(RE_TAG, "Command %ld for Bot %d done: %s", command.correlationId, command.botId, result.error ? result.error : "OK");
 }
 
-// Set flags to execute the command in the main loop
-void executeBotCommand(const std::string& command)
+// Events of the BLE worker and the NimBLE host task, delivered through the worker mailbox
+void handleBleEvent(const ReBLEEvent& event)
 {
-    if (ctx.getBleDeviceFound())
+    switch (event.type)
     {
-        ctx.setDoCommand(command);
-        ctx.setDoConnect(true);
+        case ReBLEEventType::COMMAND_STARTED:
+            LED_COLOR_UPDATE(LED_COLOR_ORANGE);
+            LED_STATUS_UPDATE(start(LED_BLE_PROCESSING));
+            break;
+        case ReBLEEventType::COMMAND_DONE:
+            onBotCommandDone(event.command, event.result);
+            break;
+        case ReBLEEventType::COMMAND_EXPIRED:
+            server->pressRequestNotifyJson(event.command.correlationId, event.command.botId, event.result);
+            break;
+        case ReBLEEventType::SCAN_MODE:
+            LED_COLOR_UPDATE(LED_COLOR_GREEN);
+
+            if (ReScanMode::AGGRESSIVE == event.scanMode)
+            {
+                LED_STATUS_UPDATE(start(LED_BLE_SCANNING));
+            }
+            else
+            {
+                LED_STATUS_UPDATE(on());
+            }
+            break;
+        case ReBLEEventType::DISCONNECTED:
+            LED_COLOR_UPDATE(LED_COLOR_GREEN);
+            LED_STATUS_UPDATE(on());
+            break;
+        default:
+            break;
+    }
+}
+
+// Queue the command for the main loop
+void executeBotCommand(uint8_t botId, ReBotOpcode opcode, ReCommandOrigin origin)
+{
+    if (ctx.getBotPresent(botId))
+    {
+        const ReBotCommandSpec &command = reBotCommand(opcode);
+        uint32_t correlationId = 0;
+
+        if (ReEnqueueResult::OK != ctx.getCommandQueue().enqueue(botId, origin, command.data, command.length, correlationId))
+        {
+            logger.warn(RE_TAG, "Command for Bot %d NOT queued, queue depth: %d", botId, ctx.getCommandQueue().depth());
+        }
     }
 }   
 
 // Matter protocol Endpoint Callback
-bool setPluginOnOff(bool state) {
-    logger.info(RE_TAG, "User Callback :: New Plugin State = %s", state ? "ON" : "OFF");
+bool setPluginOnOff(uint8_t botId, bool state) {
+    logger.info(RE_TAG, "User Callback :: Bot %d New Plugin State = %s", botId, state ? "ON" : "OFF");
   
     if (false == state)
     {
         return true;
     }
 
-    executeBotCommand(BOT_PRESS_COMMAND);
+    executeBotCommand(botId, ReBotOpcode::PRESS, ReCommandOrigin::MATTER);
     
     return true;
 }
 
+// MQTT control callback, topic "blegateway/control" addresses the first Bot, "blegateway/control/<id>" any other
+void onMqttControl(uint8_t botId, const char *payload)
+{
+    ReBotOpcode opcode;
+
+    // Command name ("press") or hex ("570100") of any known command without an argument
+    if (ReBotProtocol::lookup(payload, opcode) && 0 == reBotCommand(opcode).argLength)
+    {
+        executeBotCommand(botId, opcode, ReCommandOrigin::MQTT);
+    }
+    else
+    {
+        logger.warn(RE_TAG, "Unknown command received over MQTT: %s", payload);
+        mqttClient.publish("blegateway/result", 1, true, "ERUnknown command received over MQTT"); 
+    }
+}
+
 void setupMqttClient()
 {
     if (false == config.get<bool>("mqtt_en"))
@@ -92,15 +281,26 @@ void setupMqttClient()
             logger.debug(RE_TAG, "Received Topic: %s", topic);
             logger.debug(RE_TAG, "Received Payload: %s", payload);
 
-            if (!strcmp(payload, BOT_PRESS_COMMAND) || !strcmp(payload, BOT_STATUS_COMMAND))
-            {
-                executeBotCommand(payload);
-            }
-            else
+            onMqttControl(0, payload);
+        });
+
+    mqttClient.onTopic("blegateway/control/+", 2, [&](const char *topic, const char *payload, int retain, int qos, bool dup)
+        {
+            logger.debug(RE_TAG, "Received Topic: %s", topic);
+            logger.debug(RE_TAG, "Received Payload: %s", payload);
+
+            // Only a configured Bot ID, atoi() would turn "abc" into Bot 0 and 256 into Bot 0 too
+            const char *id = strrchr(topic, '/') + 1;
+            char *end = nullptr;
+            unsigned long botId = strtoul(id, &end, 10);
+
+            if (!isdigit((unsigned char)*id) || '\0' != *end || botId >= ctx.getBotRegistry().size())
             {
-                logger.warn(RE_TAG, "Unknown command received over MQTT: %s", payload);
-                mqttClient.publish("blegateway/result", 1, true, "ERUnknown command received over MQTT"); 
+                logger.warn(RE_TAG, "Invalid Bot ID in MQTT topic: %s", topic);
+                return;
             }
+
+            onMqttControl((uint8_t)botId, payload);
         });
 
     mqttClient.onConnect([&](bool sessionPresent)
@@ -213,29 +413,73 @@ void setup()
     server->begin();
     logger.debug(RE_TAG, "Async Web Server started");
 
-    // Setup the task to turn off the Matter switch and publish MQTT status after a delay, 
-    // in case something goes wrong with the BLE connection and it doesn't get turned off properly. 
-    // This is a safety mechanism to prevent the switch from being stuck on if there is an issue.
-    offSwitchTask.setEnabled(true);
-    offSwitchTask.setType(Mycila::Task::Type::ONCE);
+    // Command results fan out to the HTTP waiters first, MQTT publishes from its own task.
+    // Matter switch and the LED are reset after a delay, even when the command failed, 
+    // this is a safety mechanism to prevent the switch from being stuck on if there is an issue.
+    ctx.getEventBus().begin();
+    ctx.getEventBus().subscribe("http", httpResultSink);
+    ctx.getEventBus().subscribe("stream", streamResultSink);
 
-    offSwitchTask.onDone([](const Mycila::Task& me, uint32_t elapsed) {
-        logger.debug(RE_TAG, "Task '%s' executed in %ld us", me.name(), elapsed);
-    });
+    if (config.get<bool>("mqtt_en"))
+    {
+        ctx.getEventBus().subscribe("mqtt", mqttResultSink, 0, 1);
+    }
+
+    if (config.get<bool>("dev_matter"))
+    {
+        ctx.getEventBus().subscribe("matter", matterResultSink, RE_TASK_RESUME_TIME_MS);
+    }
+
+    ctx.getEventBus().subscribe("led", ledResultSink, RE_TASK_RESUME_TIME_MS);
+
+    // Publish the cached Bot state, only with MQTT enabled
+    botStateTask.setEnabled(config.get<bool>("mqtt_en"));
+    botStateTask.setType(Mycila::Task::Type::FOREVER);
+    botStateTask.setInterval(5000);
+
+    sensorTask.setEnabled(config.get<bool>("mqtt_en") && config.get<bool>("sensor_en"));
+    sensorTask.setType(Mycila::Task::Type::FOREVER);
+    sensorTask.setInterval(2000);
 
     // To allow log viewing over the web
     configureWebSerial(config.get<bool>("adm_webserial"), server);
 
+    // Main loop timing, reported on /loop and with the "loop" WebSerial command
+    loopProfiler.begin(config.get<int>("loop_stall_ms"), config.get<bool>("loop_log"));
+    server->setLoopProfiler(&loopProfiler);
+
+    if (webSerial)
+    {
+        webSerial->onMessage([](const std::string& message)
+        {
+            if ("loop" == message)
+            {
+                loopProfiler.print(*webSerial);
+            }
+        });
+    }
+
+    // Register all the Bots from the configuration, Bot ID is the position on the list
+    size_t botCount = ctx.getBotRegistry().load(config.getString("bot_mac"));
+    ctx.getBotRegistry().loadPasswords(config.getString("bot_pass"));
+    logger.debug(RE_TAG, "Registered %d Switchbot Bot(s)", botCount);
+
     // Do not move this line to another place, as the BLE device needs to be initialized before Matter 
-    bleDevice.initialize(updateAndNotifyWithBleData);
+    bleWorker.initialize();
+    bleDevice.initialize([](const ReBLEEvent& event) { bleWorker.post(event); });
+    server->setBLEDevice(&bleDevice);
 
     if (config.get<bool>("dev_matter"))
     {
-        logger.debug(RE_TAG, "Initializing Matter On/Off Plugin EndPoint");
+        logger.debug(RE_TAG, "Initializing Matter On/Off Plugin EndPoints");
 
-        // Start the Matter On/Off Plugin EndPoint and set the user callback for when the state is changed by the Matter Controller
-        onOffPlugin.begin();
-        onOffPlugin.onChange(setPluginOnOff);
+        // Start one Matter On/Off Plugin EndPoint per Bot and set the user callback for when the state is changed by the Matter Controller
+        for (ReBot &bot : ctx.getBotRegistry())
+        {
+            uint8_t botId = bot.id;
+            onOffPlugins[botId].begin();
+            onOffPlugins[botId].onChange([botId](bool state) { return setPluginOnOff(botId, state); });
+        }
 
         // Matter beginning - Last step, after all EndPoints are initialized
         Matter.begin();
@@ -244,8 +488,11 @@ void setup()
         if (Matter.isDeviceCommissioned()) 
         {
             logger.debug(RE_TAG, "Matter Node is commissioned and connected to the network. Ready for use");
-            logger.debug(RE_TAG, "Initial state: %s", onOffPlugin.getOnOff() ? "ON" : "OFF");
-            onOffPlugin.updateAccessory();  // configure the Plugin based on initial state
+            for (ReBot &bot : ctx.getBotRegistry())
+            {
+                logger.debug(RE_TAG, "Bot %d initial state: %s", bot.id, onOffPlugins[bot.id].getOnOff() ? "ON" : "OFF");
+                onOffPlugins[bot.id].updateAccessory();  // configure the Plugin based on initial state
+            }
         }
         else
         {
@@ -256,6 +503,10 @@ void setup()
     // Do not move this line to another place
     bleDevice.start();
 
+    // From now on the BLE commands run on the worker task, the main loop only handles their events
+    bleWorker.begin(&bleDevice, config.get<int>("ble_core"), config.get<int>("ble_prio"));
+    server->setBLEWorker(&bleWorker);
+
     // If MQTT is enabled in config, setup the MQTT client and connect to the broker
     setupMqttClient();
 
@@ -266,38 +517,35 @@ void setup()
 
 void loop()
 {
+    loopProfiler.start();
+
     espConnect->loop();
+    loopProfiler.mark(ReLoopStage::ESPCONNECT);
     
-    offSwitchTask.tryRun();
+    botStateTask.tryRun();
+    sensorTask.tryRun();
+    loopProfiler.mark(ReLoopStage::TASKS);
+
     ReLED.getStatusLED()->check();
-    
-    // There is a request to connect to the BLE device and execute the command
-    if (ctx.getDoConnect())
-    {
-        ctx.setDoConnect(false);
-        
-        // Found a device we want to connect to, do it now
-        if (bleDevice.executeSwitchBotCommand(ctx.getDoCommand()))
-        {
-            logger.debug(RE_TAG, "Success! we should now be getting notifications");
-            
-            LED_COLOR_UPDATE(LED_COLOR_ORANGE);
-            LED_STATUS_UPDATE(start(LED_BLE_PROCESSING));
-        }
-        // If we failed to connect or execute the command, we should reset the state and notify the user
-        else
-        {
-            logger.error(RE_TAG, "Failed to connect");
+    loopProfiler.mark(ReLoopStage::LED);
 
-            LED_COLOR_UPDATE(LED_COLOR_RED);
-            LED_STATUS_UPDATE(start(LED_BLE_ALERT));
-            
-            std::string resultData = "ERError with connection to Switchbot";
+    // Answer the HTTP requests whose command result did not come in time
+    server->loop();
+    loopProfiler.mark(ReLoopStage::SERVER);
 
-            offSwitchTask.resume(RE_TASK_RESUME_TIME_MS);
-            offSwitchTask.setData((void*)resultData.c_str());
+    // Results and state changes of the BLE worker
+    ReBLEEvent event;
 
-            server->pressRequestNotifyJson(resultData);
-        }
+    while (bleWorker.receive(event))
+    {
+        handleBleEvent(event);
     }
+
+    loopProfiler.mark(ReLoopStage::BLE_EVENTS);
+
+    // Command results to the sinks handled from the main loop
+    ctx.getEventBus().loop();
+    loopProfiler.mark(ReLoopStage::RESULTS);
+
+    loopProfiler.end();
 }
\ No newline at end of file
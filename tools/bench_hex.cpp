@@ -0,0 +1,88 @@
+// Host benchmark of the hex codec in src/ReBLEUtils.cpp, which has no Arduino dependencies:
+//
+//   g++ -O2 -std=c++17 -Isrc tools/bench_hex.cpp src/ReBLEUtils.cpp -o bench_hex && ./bench_hex
+//
+// Decodes and encodes a Bot press command and a 24 byte command, and compares the decoder
+// with the previous std::vector / substr / std::stoi one. Only the relative numbers matter,
+// the ESP32 is about an order of magnitude slower than a desktop host.
+
+#include "ReBLEUtils.h"
+
+#include <cctype>
+#include <chrono>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+#define BENCH_ROUNDS 1000000
+
+// Decoder before the fixed buffer one, without its Serial logging
+static std::vector<uint8_t> stringToHexArrayVector(const std::string &hexString)
+{
+    std::vector<uint8_t> result;
+
+    if (hexString.length() % 2 != 0)
+    {
+        return result;
+    }
+
+    for (char c : hexString)
+    {
+        if (!std::isxdigit(static_cast<unsigned char>(c)))
+        {
+            return result;
+        }
+    }
+
+    for (size_t i = 0; i < hexString.length(); i += 2)
+    {
+        result.push_back(static_cast<uint8_t>(std::stoi(hexString.substr(i, 2), nullptr, 16)));
+    }
+
+    return result;
+}
+
+// Keeps the compiler from dropping the loops
+static volatile uint32_t sink;
+
+template <typename F>
+static double nanosPerCall(F &&function)
+{
+    auto start = std::chrono::steady_clock::now();
+
+    for (uint32_t i = 0; i < BENCH_ROUNDS; i++)
+    {
+        function();
+    }
+
+    std::chrono::duration<double, std::nano> elapsed = std::chrono::steady_clock::now() - start;
+
+    return elapsed.count() / BENCH_ROUNDS;
+}
+
+static void bench(const char *name, const char *text)
+{
+    std::string hexString(text);
+    uint8_t data[64];
+    size_t length = 0;
+    char encoded[2 * sizeof(data) + 1];
+
+    double vector = nanosPerCall([&]() { sink += stringToHexArrayVector(hexString).size(); });
+    double fixed = nanosPerCall([&]()
+    {
+        stringToHexArray(text, data, sizeof(data), length);
+        sink += length;
+    });
+    double encode = nanosPerCall([&]() { sink += hexArrayToString(data, length, encoded, sizeof(encoded)); });
+
+    printf("%-8s %2zu bytes  decode vector %7.1f ns  decode fixed %6.1f ns  encode %6.1f ns\n",
+           name, length, vector, fixed, encode);
+}
+
+int main()
+{
+    bench("press", "570100");
+    bench("long", "570f31000102030405060708090a0b0c0d0e0f1011121314");
+
+    return 0;
+}
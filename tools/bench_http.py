@@ -0,0 +1,125 @@
+#!/usr/bin/env python3
+#
+# HTTP benchmark of the gateway hot routes, run from a host on the same network:
+#
+#   python3 tools/bench_http.py --host 192.168.1.50 --password secret --count 200
+#
+# Reports requests per second per route and, from the /metrics counters scraped before
+# and after each route, the heap allocations per request. The allocation counter needs a
+# firmware built with CONFIG_HEAP_USE_HOOKS, without it only the free heap delta is shown.
+#
+# The counter sees the allocations of every task. An idle window of the same length is
+# measured after each route and subtracted, what remains still includes the Wi-Fi and lwIP
+# work of the requests themselves, not only the route handler.
+
+import argparse
+import base64
+import re
+import sys
+import time
+import urllib.error
+import urllib.request
+
+ROUTES = [
+    "/switchbot/queue",
+    "/switchbot/bots",
+    "/switchbot/sessions",
+    "/switchbot/scan",
+    "/switchbot/sensors",
+    "/heap",
+    "/tasks",
+    "/loop",
+    "/metrics",
+]
+
+
+def critical(msg):
+    """Print critical message to stderr"""
+    sys.stderr.write("bench_http.py: ")
+    sys.stderr.write(msg)
+    sys.stderr.write("\n")
+
+
+def get(base, path, auth):
+    request = urllib.request.Request(base + path)
+    if auth:
+        request.add_header("Authorization", auth)
+    with urllib.request.urlopen(request, timeout=10) as response:
+        return response.status, response.read()
+
+
+def scrape(base, auth):
+    """Counters of /metrics as a name -> value dict"""
+    _, body = get(base, "/metrics", auth)
+    values = {}
+    for line in body.decode().splitlines():
+        match = re.match(r"^(blegateway_[a-z_]+) ([0-9.]+)$", line)
+        if match:
+            values[match.group(1)] = float(match.group(2))
+    return values
+
+
+def idle(base, auth, seconds):
+    """Allocations of all tasks over a window without requests, bracketed by two scrapes like a route"""
+    before = scrape(base, auth)
+    time.sleep(seconds)
+    after = scrape(base, auth)
+    return after.get("blegateway_heap_allocations_total", 0) - before.get("blegateway_heap_allocations_total", 0)
+
+
+def bench(base, path, auth, count):
+    before = scrape(base, auth)
+    failures = 0
+    start = time.monotonic()
+
+    for _ in range(count):
+        try:
+            status, _ = get(base, path, auth)
+            if status != 200:
+                failures += 1
+        except urllib.error.URLError:
+            failures += 1
+
+    elapsed = time.monotonic() - start
+    after = scrape(base, auth)
+
+    line = "%-22s %7.1f req/s  %3d failed" % (path, count / elapsed, failures)
+
+    # The idle window has the same two scrapes around it, subtracting it leaves them and the background tasks out
+    if "blegateway_heap_allocations_total" in after:
+        allocations = after["blegateway_heap_allocations_total"] - before["blegateway_heap_allocations_total"]
+        allocations -= idle(base, auth, elapsed)
+        line += "  %6.1f allocations/req" % (max(allocations, 0) / count)
+
+    line += "  heap %+d B" % (after["blegateway_heap_free_bytes"] - before["blegateway_heap_free_bytes"])
+    line += "  arena peak %d B" % after["blegateway_json_arena_peak_bytes"]
+
+    return line
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Benchmark the gateway HTTP hot routes")
+    parser.add_argument("--host", required=True, help="gateway address")
+    parser.add_argument("--port", type=int, default=80)
+    parser.add_argument("--password", help="admin password, when the routes require it")
+    parser.add_argument("--count", type=int, default=100, help="requests per route")
+    parser.add_argument("routes", nargs="*", default=ROUTES)
+    args = parser.parse_args()
+
+    base = "http://%s:%d" % (args.host, args.port)
+    auth = None
+    if args.password:
+        auth = "Basic " + base64.b64encode(("admin:" + args.password).encode()).decode()
+
+    try:
+        for path in args.routes:
+            print(bench(base, path, auth, args.count))
+    except urllib.error.URLError as e:
+        critical("%s: %s" % (base, e))
+        return 1
+
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -1,4 +1,5 @@
 import gzip
+import hashlib
 import os
 import sys
 import subprocess
@@ -41,9 +42,9 @@ for filename in ["settings.html"]:
         ]
     )
 
-    # gzip the file
+    # gzip the file, without a timestamp so the same html always gives the same blob and ETag
     with open(".pio/embed/" + filename, "rb") as inputFile:
-        with gzip.open(".pio/embed/" + filename + ".gz", "wb") as outputFile:
+        with gzip.GzipFile(".pio/embed/" + filename + ".gz", "wb", mtime=0) as outputFile:
             sys.stderr.write(
                 f"website.py: gzip '.pio/embed/{filename}' to '.pio/embed/{filename}.gz'\n"
             )
@@ -51,3 +52,9 @@ for filename in ["settings.html"]:
 
     # Delete temporary minified html
     os.remove(".pio/embed/" + filename)
+
+# ETag of the embedded settings page: hash of the gzipped blob served by /admin
+with open(".pio/embed/settings.html.gz", "rb") as inputFile:
+    etag = hashlib.sha256(inputFile.read()).hexdigest()[:16]
+    sys.stderr.write(f"website.py: settings.html.gz ETag {etag}\n")
+    env.Append(CPPDEFINES=[("RE_SETTINGS_ETAG", env.StringifyMacro(etag))])
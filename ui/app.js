@@ -44,6 +44,7 @@
 
   const validators = {
     mac: (v) => reMac.test(v) ? null : "Invalid MAC (AA:BB:CC:DD:EE:FF)",
+    maclist: (v) => String(v).split(',').every(m => reMac.test(m.trim())) ? null : "Invalid MAC list (AA:BB:CC:DD:EE:FF, ...)",
     port: (v) => {
       const n = Number(v);
       if (v === '' || v == null) return "This field is required";